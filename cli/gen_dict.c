@@ -12,6 +12,7 @@
 #include "xtree.h"
 #include "xdb.h"
 #include "xdict.h"
+#include "rule.h"
 #include "charset.h"
 #include <unistd.h>
 #include <stdio.h>
@@ -22,6 +23,34 @@
 #define	PACKAGE_NAME		"scws-mkdict"
 
 static char *program_name;
+
+static int _cmp_id(const void *a, const void *b)
+{
+	unsigned int x = *((const unsigned int *) a), y = *((const unsigned int *) b);
+	return (x > y) - (x < y);
+}
+
+/* stable word ids, the id column (5th) is kept, the others are given
+ * in the order of the input from base on, skipping the kept ones */
+static void _assign_ids(word_st **auto_list, int num, unsigned int *kept, int nkept, unsigned int base)
+{
+	int i, k;
+
+	if (nkept > 1)
+		qsort(kept, nkept, sizeof(unsigned int), _cmp_id);
+	for (i = k = 0; i < num; i++)
+	{
+		if (auto_list[i]->id != 0)
+			continue;
+		while (k < nkept && kept[k] < base) k++;
+		while (k < nkept && kept[k] == base)
+		{
+			base++;
+			k++;
+		}
+		auto_list[i]->id = base++;
+	}
+}
 static void show_usage(int code, const char *msg)
 {
 	if (code)
@@ -33,13 +62,16 @@ static void show_usage(int code, const char *msg)
 	}
 
 	printf("%s (%s/%s)\n", program_name, PACKAGE_NAME, PACKAGE_VERSION);
-	printf("Convert the plain text dictionary to xdb format.\n");
+	printf("Convert the plain text dictionary to xdb format,\n");
+	printf("or compile the ruleset to the binary image (-r).\n");
 	printf("Copyright (C)2007 by hightman.\n\n");
 	printf("Usage: %s [options] [input file] [output file]\n", program_name);
 	printf("  -i        Specified the plain text dictionary(default: dict.txt).\n");
 	printf("  -o        Specified the output file path(default: dict.xdb)\n");
 	printf("  -c        Specified the input charset(default: gbk)\n");
 	printf("  -p        Specified the PRIME num for xdb\n");
+	printf("  -b        Specified the first word id(default: 1)\n");
+	printf("  -r        Compile the ruleset(default: rules.ini -> rules.rdb)\n");
 	printf("  -v        Show the version.\n");
 	printf("  -h        Show this page.\n");
 	printf("Report bugs to <hightman2@yahoo.com.cn>\n");
@@ -49,11 +81,13 @@ static void show_usage(int code, const char *msg)
 /* usage: mk_dict -i dict.txt -o dict.xdb */
 int main(int argc, char *argv[])
 {
-	int c,t;
+	int c, t, rmode, nauto, nkept, sauto, skept, ret = 0;
 	char *input, *output, *charset, *delim = " \t\r\n";
 	FILE *fp;
 	char buf[256], *str, *ptr, *mblen;
-	word_st word, *w;
+	word_st word, *w, **auto_list;
+	unsigned int base, *kept;
+	unsigned long id;
 	xtree_t xt;
 
 	input = output = charset = NULL;
@@ -63,8 +97,9 @@ int main(int argc, char *argv[])
 		program_name = argv[0];	
 
 	/* parse the arguments */
-	t = 0;
-	while ((c = getopt(argc, argv, "i:p:o:c:vh")) != -1)
+	t = rmode = 0;
+	base = 1;
+	while ((c = getopt(argc, argv, "i:p:o:c:b:rvh")) != -1)
 	{
 		switch (c)
 		{
@@ -80,6 +115,14 @@ int main(int argc, char *argv[])
 			case 'c' :
 				charset = optarg;
 				break;
+			case 'b' :
+				base = (unsigned int) strtoul(optarg, NULL, 10);
+				if (base == 0 || base >= SCWS_WORD_ID_HASHED)
+					show_usage(-1, "Invalid first word id");
+				break;
+			case 'r' :
+				rmode = 1;
+				break;
 			case 'v' :
 				printf("%s (%s/%s: convert the plain text dictionary to xdb format)\n",
 							program_name, PACKAGE_NAME, PACKAGE_VERSION);
@@ -105,9 +148,9 @@ int main(int argc, char *argv[])
 		output = argv[optind];
 
 	if (input == NULL)
-		input = "dict.txt";
+		input = rmode ? "rules.ini" : "dict.txt";
 	if (output == NULL)
-		output = "dict.xdb";
+		output = rmode ? "rules.rdb" : "dict.xdb";
 
 	/* check the input & output */
 	if (!access(output, R_OK))
@@ -116,6 +159,31 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	/* compile the ruleset, the charset must be same with it */
+	if (rmode)
+	{
+		rule_t r;
+
+		printf("Reading the ruleset: %s ...", input);
+		fflush(stdout);
+		if ((r = scws_rule_new(input, charset_table_get(charset))) == NULL)
+		{
+			perror("Cann't load the ruleset");
+			return -1;
+		}
+		printf("OK\nCompile to: %s ... ", output);
+		fflush(stdout);
+		c = scws_rule_compile(r, output);
+		scws_rule_free(r);
+		if (c != 0)
+		{
+			perror("Failed to compile the ruleset");
+			return -1;
+		}
+		printf("OK, all been done!\n");
+		return 0;
+	}
+
 	if ((fp = fopen(input, "r")) == NULL)
 	{
 		perror("Cann't open the input file");
@@ -137,10 +205,13 @@ int main(int argc, char *argv[])
 	fflush(stdout);
 
 	t = 0;
+	nauto = nkept = sauto = skept = 0;
+	auto_list = NULL;
+	kept = NULL;
 	word.attr[2] = '\0';
 	while (fgets(buf, sizeof(buf)-1, fp) != NULL)
 	{
-		// <word>\t<tf>\t<idf>\t<attr>\n
+		// <word>\t<tf>\t<idf>\t<attr>[\t<id>]\n
 		if (buf[0] == ';' || buf[0] == '#')
 			continue;
 
@@ -155,6 +226,8 @@ int main(int argc, char *argv[])
 			word.flag = SCWS_WORD_FULL;
 			word.attr[0] = '@';
 			word.attr[1] = '\0';
+			word.id = 0;
+			id = 0;
 
 			if (!(ptr = strtok(NULL, delim))) break;
 			word.tf = (float) atof(ptr);
@@ -162,13 +235,36 @@ int main(int argc, char *argv[])
 			if (!(ptr = strtok(NULL, delim))) break;
 			word.idf = (float) atof(ptr);
 
-			if (ptr = strtok(NULL, delim))
-			{
-				word.attr[0] = ptr[0];
-				if (ptr[1]) word.attr[1] = ptr[1];
-			}
+			if (!(ptr = strtok(NULL, delim))) break;
+			word.attr[0] = ptr[0];
+			if (ptr[1]) word.attr[1] = ptr[1];
+
+			if (!(ptr = strtok(NULL, delim))) break;
+			id = strtoul(ptr, NULL, 10);
 		} while (0);
 
+		/* the hashed ids have the high bit set, never mix them up */
+		if (id >= SCWS_WORD_ID_HASHED)
+		{
+			fprintf(stderr, "\nInvalid word id: %s %s (must be less than %u)\n", str, ptr, SCWS_WORD_ID_HASHED);
+			if (auto_list != NULL)
+				free(auto_list);
+			if (kept != NULL)
+				free(kept);
+			xtree_free(xt);
+			ret = -1;
+			goto mk_end;
+		}
+		word.id = (unsigned int) id;
+
+		/* the kept id, or wait for one */
+		if (word.id != 0)
+		{
+			if (nkept == skept)
+				kept = (unsigned int *) realloc(kept, sizeof(unsigned int) * (skept = skept ? skept << 1 : 1024));
+			kept[nkept++] = word.id;
+		}
+
 		/* save the word */
 		//printf("word: %s (len=%d)\n", str, c);
 		if ((w = xtree_nget(xt, str, c, NULL)) == NULL)
@@ -184,6 +280,14 @@ int main(int argc, char *argv[])
 			w->idf = word.idf;
 			w->flag |= SCWS_WORD_FULL;
 			strcpy(w->attr, word.attr);
+			if (word.id != 0)
+				w->id = word.id;
+		}
+		if (word.id == 0 && w->id == 0)
+		{
+			if (nauto == sauto)
+				auto_list = (word_st **) realloc(auto_list, sizeof(word_st *) * (sauto = sauto ? sauto << 1 : 1024));
+			auto_list[nauto++] = w;
 		}
 
 		/* parse the part */		
@@ -209,6 +313,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* the ids of the words */
+	_assign_ids(auto_list, nauto, kept, nkept, base);
+	if (auto_list != NULL)
+		free(auto_list);
+	if (kept != NULL)
+		free(kept);
+
 	/* save to xdb & free the xtree */
 	printf("OK, total nodes=%d\nOptimizing... ", t);
 	fflush(stdout);
@@ -225,5 +336,5 @@ int main(int argc, char *argv[])
 
 mk_end:
 	fclose(fp);
-	return 0;	
+	return ret;	
 }
@@ -39,8 +39,12 @@ static void show_usage(int code, const char *msg)
 	printf("  -i <file|string> input string or filepath \n");
 	printf("                   (default: try to read from <stdin> everyline)\n");
 	printf("  -o <file>        output filepath (default to <stdout>)\n");
+	printf("  -O <file>        write the binary token stream (one doc per input line) to file\n");
+	printf("                   the input may also be a token stream, it is shown without segment\n");
 	printf("  -c <charset>     set the charset (default: gbk)\n");
 	printf("                   charset must been same with dictionary & ruleset\n");
+	printf("  -C <charset>     charset of the input (gbk|big5), converted to the utf8 dict\n");
+	printf("                   & ruleset of -c utf8, the output keeps the input charset\n");
 	printf("  -r <file>        set the ruleset file (default: none)\n");
 	printf("  -d <file>        set the dictionary file[s] (default: none)\n");
 	printf("                   if there are multi files, split filepath use ':'\n");
@@ -53,6 +57,9 @@ static void show_usage(int code, const char *msg)
 	printf("  -N               don't show time usage and warnings\n");
 	printf("  -D               debug segment, see the segment detail\n");
 	printf("  -U               use duality algorithm for single chinese\n");		   
+	printf("  -G <1|2>         greedy segment for speed, 1|2: forward|backward maximum matching\n");
+	printf("  -T <NUM>         segment the input file on NUM threads (0: all cpus)\n");
+	printf("  -B <NUM>         work budget per chunk, greedy segment the rest over it (e.g. 1000)\n");
 	printf("  -t <NUM>         fetch the top words instead of segment\n");
 	printf("  -a [~]<attr1,attr2,...>   prefix by ~ means exclude them.\n");
 	printf("                   For topwords, exclude or include some word attrs\n");
@@ -62,46 +69,190 @@ static void show_usage(int code, const char *msg)
 	exit(0);
 }
 
+#define	___PRINTRES___										\
+cur = res;													\
+while (cur != NULL)											\
+{															\
+	fprintf(fout, "%.*s", cur->len, str + cur->off);		\
+	if (cur->len != 1 || ((*(str + cur->off) != '\n')		\
+		&& (*(str + cur->off) != '\r')))					\
+	{														\
+		if (xmode & XMODE_SHOW_ATTR)						\
+			fprintf(fout, "/%.2s", cur->attr);				\
+		fprintf(fout, " ");									\
+	}														\
+	cur = cur->next;										\
+}															\
+fflush(fout);												\
+scws_free_result(res);
+
 #define	___DOSEGMENT___										\
 bytes += (fsize = strlen(str));								\
 scws_send_text(s, str, fsize);								\
-while ((cur = res = scws_get_result(s)) != NULL)			\
+while ((res = scws_get_result(s)) != NULL)					\
 {															\
-	while (cur != NULL)										\
-	{														\
-		fprintf(fout, "%.*s", cur->len, str + cur->off);	\
-		if (cur->len != 1 || ((*(str + cur->off) != '\n')	\
-			&& (*(str + cur->off) != '\r')))				\
-		{													\
-			if (xmode & XMODE_SHOW_ATTR)					\
-				fprintf(fout, "/%.2s", cur->attr);			\
-			fprintf(fout, " ");								\
-		}													\
-		cur = cur->next;									\
-	}														\
-	fflush(fout);											\
-	scws_free_result(res);									\
-}
+	___PRINTRES___											\
+}															\
+degraded += scws_get_degraded(s);
 
 #define	XMODE_SHOW_ATTR		0x01
 #define	XMODE_DICT_MEM		0x02
 #define	XMODE_DO_STAT		0x04
-#define	XMODE_STAT_FILE		0x08
 #define	XMODE_NO_TIME		0x10
 
+/* read a line of any length without the newline, return -1 at the end */
+static int _read_line(FILE *fp, char **buf, int *size)
+{
+	int len = 0;
+
+	while (fgets(*buf + len, *size - len, fp) != NULL)
+	{
+		len += strlen(*buf + len);
+		if (len > 0 && (*buf)[len-1] == '\n')
+			break;
+		if (len == (*size - 1))
+			*buf = (char *) realloc(*buf, (*size <<= 1));
+	}
+	if (len == 0 && feof(fp))
+		return -1;
+	while (len > 0 && ((*buf)[len-1] == '\n' || (*buf)[len-1] == '\r'))
+		len--;
+	(*buf)[len] = '\0';
+	return len;
+}
+
+#define	XTOK_BATCH_SIZE		(4<<20)
+
+/* segment the lines into the token stream, a batch of lines on multi threads if threads >= 0 */
+static int _write_xtok(scws_t s, FILE *fin, xtok_writer_t w, int threads)
+{
+	char *line, *text;
+	const char **docs;
+	int *offs, *lens, size, tsize, used, num, max, len, i, bytes;
+	scws_batch_t b;
+
+	size = 4096;
+	line = (char *) malloc(size);
+	tsize = XTOK_BATCH_SIZE;
+	text = (char *) malloc(tsize);
+	max = 1024;
+	docs = (const char **) malloc(sizeof(char *) * max);
+	offs = (int *) malloc(sizeof(int) * max);
+	lens = (int *) malloc(sizeof(int) * max);
+	used = num = bytes = 0;
+	do
+	{
+		if ((len = _read_line(fin, &line, &size)) >= 0)
+		{
+			bytes += len + 1;
+			if (threads < 0)
+			{
+				scws_send_text(s, line, len);
+				scws_tok_add(s, w);
+				continue;
+			}
+			if ((used + len) > tsize)
+			{
+				while ((used + len) > tsize) tsize <<= 1;
+				text = (char *) realloc(text, tsize);
+			}
+			if (num == max)
+			{
+				max <<= 1;
+				docs = (const char **) realloc(docs, sizeof(char *) * max);
+				offs = (int *) realloc(offs, sizeof(int) * max);
+				lens = (int *) realloc(lens, sizeof(int) * max);
+			}
+			memcpy(text + used, line, len);
+			offs[num] = used;
+			lens[num++] = len;
+			used += len;
+		}
+		if (num > 0 && (len < 0 || used >= XTOK_BATCH_SIZE))
+		{
+			for (i = 0; i < num; i++)
+				docs[i] = text + offs[i];
+			if ((b = scws_segment_batch(s, docs, lens, num, threads)) == NULL)
+			{
+				fprintf(stderr, "ERROR: out of memory\n");
+				break;
+			}
+			for (i = 0; i < num; i++)
+				scws_tok_add_batch(w, b, i, docs[i], lens[i]);
+			scws_free_batch(b);
+			used = num = 0;
+		}
+	}
+	while (len >= 0);
+
+	free(lens);
+	free(offs);
+	free(docs);
+	free(text);
+	free(line);
+	return bytes;
+}
+
+static int _is_xtok(FILE *fp)
+{
+	char magic[4];
+	int ret;
+
+	ret = (fread(magic, 1, 4, fp) == 4 && !memcmp(magic, XTOK_MAGIC, 4));
+	rewind(fp);
+	return ret;
+}
+
+/* show a token stream as the text output */
+static int _show_xtok(const char *fpath, FILE *fout, int xmode)
+{
+	struct xtok_token tok;
+	xtok_iter it;
+	xtok_t t;
+	const char *str;
+	unsigned int i;
+	int len, bytes;
+
+	if ((t = xtok_open(fpath)) == NULL)
+		return -1;
+	if (!(t->flags & XTOK_F_TEXT))
+	{
+		xtok_close(t);
+		return -1;
+	}
+
+	for (i = bytes = 0; i < t->ndoc; i++)
+	{
+		str = xtok_text(t, i, &len);
+		bytes += len;
+		xtok_doc(t, i, &it);
+		while (xtok_next(t, &it, &tok) && tok.off >= 0 && (tok.off + tok.len) <= len)
+		{
+			fprintf(fout, "%.*s", tok.len, str + tok.off);
+			if (xmode & XMODE_SHOW_ATTR)
+				fprintf(fout, "/%.2s", tok.attr);
+			fprintf(fout, " ");
+		}
+		fprintf(fout, "\n");
+	}
+	xtok_close(t);
+	return bytes;
+}
+
 int main(int argc, char *argv[])
 {	
-	int c, xmode, fsize, tlimit, bytes;
+	int c, xmode, fsize, tlimit, bytes, threads, degraded;
 	FILE *fin, *fout;
-	char *str, buf[2048], *attr;
+	char *str, buf[2048], *attr, *ipath, *opath, *icharset;
 	scws_t s;
 	struct stat st;
 	scws_res_t res, cur;
 	struct timeval t1, t2, t3;
 
 	fin = fout = (FILE *) NULL;
-	str = attr = NULL;
-	bytes = xmode = fsize = tlimit = 0;
+	str = attr = ipath = opath = icharset = NULL;
+	bytes = xmode = fsize = tlimit = degraded = 0;
+	threads = -1;
 	if ((program_name = strrchr(argv[0], '/')) != NULL)
 		program_name++;
 	else
@@ -114,7 +265,7 @@ int main(int argc, char *argv[])
 	s = scws_new();
 
 	/* parse the arguments */
-	while ((c = getopt(argc, argv, "i:o:c:r:d:t:a:M:NDUEIAvh")) != -1)
+	while ((c = getopt(argc, argv, "i:o:O:c:C:r:d:t:a:M:G:T:B:NDUEIAvh")) != -1)
 	{
 		switch (c)
 		{
@@ -123,6 +274,8 @@ int main(int argc, char *argv[])
 					fclose(fin);
 				if (stat(optarg, &st) || !S_ISREG(st.st_mode) || !(fin = fopen(optarg, "r")))
 					str = optarg;
+				else
+					ipath = optarg;
 				fsize = st.st_size;
 				break;
 			case 'o' :
@@ -139,9 +292,15 @@ int main(int argc, char *argv[])
 					goto cws_end;
 				}
 				break;
+			case 'O' :
+				opath = optarg;
+				break;
 			case 'c' :
 				scws_set_charset(s, optarg);
 				break;
+			case 'C' :
+				icharset = optarg;
+				break;
 			case 'r' :
 				scws_set_rule(s, optarg);
 				if (s->r == NULL && !(xmode & XMODE_NO_TIME))
@@ -187,6 +346,15 @@ int main(int argc, char *argv[])
 			case 'U' :
 				scws_set_duality(s, SCWS_YEA);
 				break;
+			case 'G' :
+				scws_set_greedy(s, (atoi(optarg)<<5));
+				break;
+			case 'T' :
+				threads = atoi(optarg);
+				break;
+			case 'B' :
+				scws_set_budget(s, atoi(optarg));
+				break;
 			case 't' :
 				xmode |= XMODE_DO_STAT;
 				tlimit = atoi(optarg);
@@ -208,6 +376,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* the input charset is set after the dict charset */
+	if (icharset != NULL && scws_set_input_charset(s, icharset) != 0)
+	{
+		fprintf(stderr, "ERROR: input charset not convertible to the dict charset. '%s'\n", icharset);
+		goto cws_end;
+	}
+
 	/* other arguments */
 	argc -= optind;
 	if (argc > 0 && fin == NULL && str == NULL)
@@ -217,6 +392,8 @@ int main(int argc, char *argv[])
 		{		
 			if (stat(optarg, &st) || !S_ISREG(st.st_mode) || !(fin = fopen(optarg, "r")))
 				str = optarg;
+			else
+				ipath = optarg;
 			fsize = st.st_size;
 			argc--;
 		}
@@ -237,7 +414,36 @@ int main(int argc, char *argv[])
 	if (!(xmode & XMODE_NO_TIME))
 		gettimeofday(&t2, NULL);
 
-	if (xmode & XMODE_DO_STAT)
+	if (fin != NULL && ipath != NULL && _is_xtok(fin))
+	{
+		/* a token stream as input */
+		if ((bytes = _show_xtok(ipath, fout, xmode)) < 0)
+		{
+			fprintf(stderr, "ERROR: the token stream is broken or has no text. '%s'\n", ipath);
+			goto cws_end;
+		}
+	}
+	else if (opath != NULL)
+	{
+		xtok_writer_t w;
+
+		if ((w = xtok_create(opath, XTOK_F_TEXT | XTOK_F_ID)) == NULL)
+		{
+			fprintf(stderr, "ERROR: token stream write failed. '%s'\n", opath);
+			goto cws_end;
+		}
+		if (str != NULL)
+		{
+			bytes = strlen(str);
+			scws_send_text(s, str, bytes);
+			scws_tok_add(s, w);
+		}
+		else
+			bytes = _write_xtok(s, fin != NULL ? fin : stdin, w, threads);
+		if (xtok_finish(w) != 0)
+			fprintf(stderr, "ERROR: token stream write failed. '%s'\n", opath);
+	}
+	else if (xmode & XMODE_DO_STAT)
 	{
 		/* do the stats only */		
 		if (str == NULL && fin == NULL)		
@@ -248,24 +454,19 @@ int main(int argc, char *argv[])
 
 			if (str == NULL)
 			{
-				int b;
-
-				c = b = 0;
-				str = (char *) malloc(fsize);
-				while (fsize > 0)
+				/* mapped by scws, released by scws_free() */
+				if (scws_send_fd(s, fileno(fin)) < 0)
 				{
-					b = fread(str + c, 1, fsize, fin);
-					fsize -= b;
-					c += b;
+					fprintf(stderr, "ERROR: input file read failed.\n");
+					goto cws_end;
 				}
-				xmode |= XMODE_STAT_FILE;
+				c = (int) s->fmap_len;
 			}
 			else
 			{
 				c = strlen(str);
+				scws_send_text(s, str, c);
 			}
-			
-			scws_send_text(s, str, c);
 			bytes = c;
 			fprintf(fout, "No. WordString               Attr  Weight(times)\n");
 			fprintf(fout, "-------------------------------------------------\n");
@@ -286,10 +487,22 @@ int main(int argc, char *argv[])
 				fprintf(fout, "EMPTY records!\n");
 			}
 
-			if (xmode & XMODE_STAT_FILE)
-				free(str);	
 		}
 	}
+	else if (str == NULL && fin != NULL && threads >= 0)
+	{
+		/* map the whole file, then segment it on multi threads */
+		if (scws_send_fd(s, fileno(fin)) < 0)
+		{
+			fprintf(stderr, "ERROR: input file read failed.\n");
+			goto cws_end;
+		}
+		str = (char *) s->fmap;
+		bytes = (int) s->fmap_len;
+		res = scws_get_result_mt(s, threads);
+		degraded = scws_get_degraded(s);
+		___PRINTRES___
+	}
 	else if (str == NULL)
 	{
 		str = buf;
@@ -316,6 +529,8 @@ int main(int argc, char *argv[])
 						(t2.tv_sec - t1.tv_sec) + (float)(t2.tv_usec - t1.tv_usec)/1000000);
 		fprintf(stderr, "| Segment:   %-10.4f(sec)     |\n",
 						(t3.tv_sec - t2.tv_sec) + (float)(t3.tv_usec - t2.tv_usec)/1000000);
+		if (s->budget > 0)
+			fprintf(stderr, "| Degraded:  %-10d(chunks)  |\n", degraded);
 		fprintf(stderr, "+--------------------------------+\n");
 	}
 
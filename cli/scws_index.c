@@ -0,0 +1,1068 @@
+/**
+ * @file scws_index.c (build an inverted index of a corpus by the word ids & query it)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "scws.h"
+#include "xthread.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#undef PACKAGE_NAME
+#define	PACKAGE_NAME		"scws-index"
+
+/**
+ * index file (native byte order):
+ *   header | postings of each term | term table (sorted by id) | doc table | doc names
+ * postings of a term, all in vbyte: <doc delta> <tf> <tf position deltas> ... per doc,
+ * doc delta is (doc + 1) - (previous doc + 1), positions are the ordinals of the tokens in the doc
+ */
+#define	SIDX_MAGIC			"SIDX"
+#define	SIDX_VERSION		1
+#define	SIDX_F_LINES		0x01		/* one doc per line, no doc names */
+
+#define	SIDX_BATCH_SIZE		(8<<20)		/* text bytes per batch */
+
+#define	XMODE_DICT_MEM		0x02
+#define	XMODE_NO_TIME		0x10
+
+struct sidx_header
+{
+	char magic[4];
+	int version;
+	int flags;
+	unsigned int ndoc;
+	unsigned int nterm;
+	unsigned int pad;
+	unsigned long long ntoken;
+	unsigned long long term_off;
+	unsigned long long doc_off;
+	unsigned long long name_size;
+};
+
+struct sidx_term
+{
+	unsigned int id;
+	unsigned int df;
+	unsigned long long off;
+	unsigned long long len;
+};
+
+struct sidx_doc
+{
+	unsigned int ntok;
+	unsigned int name;		/* offset in the doc names */
+};
+
+/* a token of the doc being added, the multi expansions share the position of their base word */
+struct sidx_tok
+{
+	int ent;
+	unsigned int pos;
+};
+
+/* a term being built */
+struct sidx_entry
+{
+	unsigned int id;
+	unsigned int df;
+	unsigned int doc;		/* last doc + 1, 0: none */
+	unsigned int pos;		/* last position in the doc */
+	int tf;					/* in the current doc, before its postings are written */
+	int len;
+	int size;
+	unsigned char *buf;
+};
+
+typedef struct
+{
+	int num;
+	int size;
+	int bits;
+	int *slot;				/* entry index + 1, 0: empty */
+	struct sidx_entry *ents;
+	unsigned int ndoc;
+	unsigned int dsize;
+	struct sidx_doc *docs;
+	int name_len;
+	int name_size;
+	char *names;
+	unsigned long long ntoken;
+	int tsize;
+	struct sidx_tok *toks;	/* tokens of a doc */
+}	sidx_st, *sidx_t;
+
+/* the corpus reader: lines of a file, or the files of a directory */
+typedef struct
+{
+	FILE *fp;
+	char *rest;				/* partial line carried to the next batch */
+	int rlen;
+	int rsize;
+	char **files;
+	int nfile;
+	int fsize;
+	int next;
+	unsigned long long bytes;
+}	sidx_reader_st, *sidx_reader_t;
+
+/* a batch of docs, segmented on the other thread while the previous one is indexed */
+struct sidx_batch
+{
+	char *buf;
+	int size;
+	int used;
+	const char **docs;
+	int *lens;
+	const char **names;		/* file of the docs, NULL for lines */
+	int num;
+	int max;
+	scws_t s;
+	int threads;
+	scws_batch_t res;
+	xthread_t tid;
+	int running;
+};
+
+static char *program_name;
+static void show_usage(int code, const char *msg)
+{
+	if (code)
+	{
+		if (msg != NULL)
+			fprintf(stderr, "%s: %s\n", PACKAGE_NAME, msg);
+		fprintf(stderr, "Try `%s -h' for more information.\n", program_name);
+		exit(code);
+	}
+
+	printf("%s (%s/%s)\n", program_name, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Simple Chinese Word Segmentation - Build & query the inverted index.\n");
+	printf("Copyright (C)2007 by hightman.\n\n");
+	printf("Usage: %s [options] -i <corpus> -o <index>\n", program_name);
+	printf("       %s [options] -q <query> <index>\n", program_name);
+	printf("  -i <file|dir>    corpus: a file of one doc per line, or a directory of doc files\n");
+	printf("  -o <file>        output index filepath (default: scws.idx)\n");
+	printf("  -q <string>      query the index: docs having all the words of the string\n");
+	printf("  -p               phrase query, the words must be adjacent in order\n");
+	printf("  -n <NUM>         max docs to show for the query (default: 10)\n");
+	printf("  -c <charset>     set the charset (default: gbk)\n");
+	printf("  -C <charset>     charset of the corpus & query (gbk|big5), converted to -c utf8\n");
+	printf("  -r <file>        set the ruleset file (default: none)\n");
+	printf("  -d <file>        set the dictionary file[s] (default: none)\n");
+	printf("                   the same charset, dict & ruleset must be used to build & query\n");
+	printf("  -M <1~15>        use multi child words mode, see scws -h\n");
+	printf("  -E               import the xdb dict into xtree(memory)\n");
+	printf("  -T <NUM>         segment on NUM threads (default 0: all cpus)\n");
+	printf("  -N               don't show time usage and warnings\n");
+	printf("  -v        Show the version.\n");
+	printf("  -h        Show this page for help.\n");
+	printf("Report bugs to <hightman2@yahoo.com.cn>\n");
+	exit(0);
+}
+
+/* vbyte: 7 bits a byte, low first, the high bit means more */
+static inline int _vbyte_put(unsigned char *p, unsigned int v)
+{
+	int n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char) v;
+	return n;
+}
+
+static inline unsigned int _vbyte_get(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	unsigned int v = 0;
+	int shift = 0;
+
+	while (p < end && (*p & 0x80))
+	{
+		v |= (unsigned int) (*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	if (p < end)
+		v |= (unsigned int) *p++ << shift;
+	*pp = p;
+	return v;
+}
+
+#define	_SLOT(id,bits)		(((id) * 2654435761U) >> (32 - (bits)))
+
+static sidx_t sidx_new()
+{
+	sidx_t x;
+
+	x = (sidx_t) calloc(1, sizeof(sidx_st));
+	x->bits = 12;
+	x->size = 1 << (x->bits - 1);
+	x->ents = (struct sidx_entry *) malloc(sizeof(struct sidx_entry) * x->size);
+	x->slot = (int *) calloc(1 << x->bits, sizeof(int));
+	x->dsize = 1024;
+	x->docs = (struct sidx_doc *) malloc(sizeof(struct sidx_doc) * x->dsize);
+	x->name_size = 1024;
+	x->names = (char *) malloc(x->name_size);
+	x->names[x->name_len++] = '\0';
+	return x;
+}
+
+static void sidx_free(sidx_t x)
+{
+	int i;
+
+	for (i = 0; i < x->num; i++)
+		free(x->ents[i].buf);
+	free(x->ents);
+	free(x->slot);
+	free(x->docs);
+	free(x->names);
+	if (x->toks != NULL)
+		free(x->toks);
+	free(x);
+}
+
+/* index of the entry of the id, added if not found */
+static int sidx_entry(sidx_t x, unsigned int id)
+{
+	int i, j, mask;
+
+	mask = (1 << x->bits) - 1;
+	for (j = _SLOT(id, x->bits); x->slot[j] != 0; j = (j + 1) & mask)
+	{
+		if (x->ents[x->slot[j] - 1].id == id)
+			return x->slot[j] - 1;
+	}
+
+	memset(&x->ents[x->num], 0, sizeof(struct sidx_entry));
+	x->ents[x->num].id = id;
+	x->slot[j] = ++x->num;
+
+	// keep the load under 1/2
+	if (x->num == x->size)
+	{
+		x->size <<= 1;
+		x->bits++;
+		x->ents = (struct sidx_entry *) realloc(x->ents, sizeof(struct sidx_entry) * x->size);
+		x->slot = (int *) realloc(x->slot, sizeof(int) << x->bits);
+		memset(x->slot, 0, sizeof(int) << x->bits);
+		mask = (1 << x->bits) - 1;
+		for (i = 0; i < x->num; i++)
+		{
+			for (j = _SLOT(x->ents[i].id, x->bits); x->slot[j] != 0; j = (j + 1) & mask);
+			x->slot[j] = i + 1;
+		}
+	}
+	return x->num - 1;
+}
+
+static inline void _sidx_put(struct sidx_entry *e, unsigned int v)
+{
+	if ((e->len + 5) > e->size)
+	{
+		e->size = (e->size == 0 ? 16 : (e->size << 1));
+		e->buf = (unsigned char *) realloc(e->buf, e->size);
+	}
+	e->len += _vbyte_put(e->buf + e->len, v);
+}
+
+#define	SIDX_SKIP_TOKEN(txt,r)	((r)->len == 1 && ((txt)[(r)->off] == '\n' || (txt)[(r)->off] == '\r'))
+
+/* add the tokens of a doc (view: the views of res, see scws_batch), tf is counted first
+ * since it goes before the positions */
+static void sidx_add_doc(sidx_t x, const char *txt, scws_res_t res, const unsigned char *view, const char *name)
+{
+	struct sidx_entry *e;
+	scws_res_t cur;
+	unsigned int doc, pos;
+	int i, k, len;
+
+	doc = x->ndoc;
+	pos = 0;
+	for (cur = res, k = len = 0; cur != NULL; cur = cur->next, k++)
+	{
+		if (SIDX_SKIP_TOKEN(txt, cur))
+			continue;
+		if (len == x->tsize)
+		{
+			x->tsize = (x->tsize == 0 ? 1024 : (x->tsize << 1));
+			x->toks = (struct sidx_tok *) realloc(x->toks, sizeof(struct sidx_tok) * x->tsize);
+		}
+		if (view[k] == SCWS_VIEW_BASE && len > 0)
+			pos++;
+		i = sidx_entry(x, cur->id);
+		x->ents[i].tf++;
+		x->toks[len].ent = i;
+		x->toks[len++].pos = pos;
+	}
+
+	for (i = 0; i < len; i++)
+	{
+		e = &x->ents[x->toks[i].ent];
+		pos = x->toks[i].pos;
+		if (e->tf > 0)
+		{
+			_sidx_put(e, doc + 1 - e->doc);
+			_sidx_put(e, e->tf);
+			e->doc = doc + 1;
+			e->tf = 0;
+			e->df++;
+			_sidx_put(e, pos);
+		}
+		else
+			_sidx_put(e, pos - e->pos);
+		e->pos = pos;
+	}
+
+	if (x->ndoc == x->dsize)
+	{
+		x->dsize <<= 1;
+		x->docs = (struct sidx_doc *) realloc(x->docs, sizeof(struct sidx_doc) * x->dsize);
+	}
+	x->docs[doc].ntok = (len > 0 ? pos + 1 : 0);
+	x->ntoken += len;
+	x->docs[doc].name = 0;
+	if (name != NULL)
+	{
+		len = strlen(name) + 1;
+		while ((x->name_len + len) > x->name_size)
+		{
+			x->name_size <<= 1;
+			x->names = (char *) realloc(x->names, x->name_size);
+		}
+		x->docs[doc].name = x->name_len;
+		memcpy(x->names + x->name_len, name, len);
+		x->name_len += len;
+	}
+	x->ndoc++;
+}
+
+static int _sidx_cmp_id(const void *a, const void *b)
+{
+	unsigned int x = ((const struct sidx_entry *) a)->id;
+	unsigned int y = ((const struct sidx_entry *) b)->id;
+
+	return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static int sidx_save(sidx_t x, const char *fpath, int flags)
+{
+	struct sidx_header hdr;
+	struct sidx_term term;
+	FILE *fp;
+	unsigned long long off;
+	int i;
+
+	if ((fp = fopen(fpath, "wb")) == NULL)
+		return -1;
+
+	/* the slots are useless from now on */
+	qsort(x->ents, x->num, sizeof(struct sidx_entry), _sidx_cmp_id);
+
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	for (i = 0; i < x->num; i++)
+		fwrite(x->ents[i].buf, x->ents[i].len, 1, fp);
+
+	off = sizeof(hdr);
+	for (i = 0; i < x->num; i++)
+	{
+		memset(&term, 0, sizeof(term));
+		term.id = x->ents[i].id;
+		term.df = x->ents[i].df;
+		term.off = off;
+		term.len = x->ents[i].len;
+		fwrite(&term, sizeof(term), 1, fp);
+		off += x->ents[i].len;
+	}
+	fwrite(x->docs, sizeof(struct sidx_doc), x->ndoc, fp);
+	fwrite(x->names, x->name_len, 1, fp);
+
+	memcpy(hdr.magic, SIDX_MAGIC, 4);
+	hdr.version = SIDX_VERSION;
+	hdr.flags = flags;
+	hdr.ndoc = x->ndoc;
+	hdr.nterm = x->num;
+	hdr.ntoken = x->ntoken;
+	hdr.term_off = off;
+	hdr.doc_off = off + sizeof(struct sidx_term) * x->num;
+	hdr.name_size = x->name_len;
+	rewind(fp);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	i = ferror(fp) ? -1 : 0;
+	fclose(fp);
+	return i;
+}
+
+/* list the regular files under the dir (sorted, recursively) */
+static int _cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void _reader_scan_dir(sidx_reader_t r, const char *dir)
+{
+	struct dirent *de;
+	struct stat st;
+	DIR *dp;
+	char *path;
+	int i, base, len;
+
+	if ((dp = opendir(dir)) == NULL)
+		return;
+
+	base = r->nfile;
+	len = strlen(dir);
+	while ((de = readdir(dp)) != NULL)
+	{
+		if (de->d_name[0] == '.')
+			continue;
+		path = (char *) malloc(len + strlen(de->d_name) + 2);
+		sprintf(path, "%s/%s", dir, de->d_name);
+		if (r->nfile == r->fsize)
+		{
+			r->fsize = (r->fsize == 0 ? 256 : (r->fsize << 1));
+			r->files = (char **) realloc(r->files, sizeof(char *) * r->fsize);
+		}
+		r->files[r->nfile++] = path;
+	}
+	closedir(dp);
+
+	/* sort this level, then expand the sub dirs in place */
+	qsort(r->files + base, r->nfile - base, sizeof(char *), _cmp_str);
+	len = r->nfile;
+	for (i = base; i < len; i++)
+	{
+		if (stat(r->files[i], &st) || !S_ISDIR(st.st_mode))
+			continue;
+		path = r->files[i];
+		r->files[i] = NULL;
+		_reader_scan_dir(r, path);
+		free(path);
+	}
+}
+
+static sidx_reader_t reader_open(const char *fpath)
+{
+	sidx_reader_t r;
+	struct stat st;
+	int i, j;
+
+	if (stat(fpath, &st))
+		return NULL;
+
+	r = (sidx_reader_t) calloc(1, sizeof(sidx_reader_st));
+	if (S_ISDIR(st.st_mode))
+	{
+		_reader_scan_dir(r, fpath);
+		/* drop the holes of the sub dirs, keep the order */
+		for (i = j = 0; i < r->nfile; i++)
+		{
+			if (r->files[i] != NULL)
+				r->files[j++] = r->files[i];
+		}
+		r->nfile = j;
+	}
+	else if ((r->fp = fopen(fpath, "rb")) == NULL)
+	{
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+static void reader_close(sidx_reader_t r)
+{
+	int i;
+
+	if (r->fp != NULL)
+		fclose(r->fp);
+	for (i = 0; i < r->nfile; i++)
+		free(r->files[i]);
+	if (r->files != NULL)
+		free(r->files);
+	if (r->rest != NULL)
+		free(r->rest);
+	free(r);
+}
+
+static void _batch_reserve(struct sidx_batch *b, int size)
+{
+	if ((b->used + size) > b->size)
+	{
+		while ((b->used + size) > b->size)
+			b->size = (b->size == 0 ? SIDX_BATCH_SIZE : (b->size << 1));
+		b->buf = (char *) realloc(b->buf, b->size);
+	}
+}
+
+static void _batch_add(struct sidx_batch *b, int off, int len, const char *name)
+{
+	if (b->num == b->max)
+	{
+		b->max = (b->max == 0 ? 4096 : (b->max << 1));
+		b->docs = (const char **) realloc(b->docs, sizeof(char *) * b->max);
+		b->lens = (int *) realloc(b->lens, sizeof(int) * b->max);
+		b->names = (const char **) realloc(b->names, sizeof(char *) * b->max);
+	}
+	/* offsets first, the buffer may still move */
+	b->docs[b->num] = (const char *) (size_t) off;
+	b->names[b->num] = name;
+	b->lens[b->num++] = len;
+}
+
+/* fill the batch with the next docs, return the number of docs (0: the end) */
+static int reader_fill(sidx_reader_t r, struct sidx_batch *b)
+{
+	int i, n, start;
+	FILE *fp;
+
+	b->used = b->num = 0;
+	if (r->fp != NULL)
+	{
+		/* the partial line of the last batch */
+		_batch_reserve(b, r->rlen + 1);
+		if (r->rlen > 0)
+			memcpy(b->buf, r->rest, r->rlen);
+		b->used = r->rlen;
+		r->rlen = 0;
+		do
+		{
+			_batch_reserve(b, SIDX_BATCH_SIZE >> 2);
+			n = fread(b->buf + b->used, 1, b->size - b->used - 1, r->fp);
+			r->bytes += n;
+			b->used += n;
+			for (i = b->used - 1; i >= 0 && b->buf[i] != '\n'; i--);
+		}
+		while (i < 0 && n > 0);
+
+		/* keep the tail after the last newline for the next batch */
+		if (n > 0 && i >= 0 && i < (b->used - 1))
+		{
+			r->rlen = b->used - i - 1;
+			if (r->rlen > r->rsize)
+				r->rest = (char *) realloc(r->rest, (r->rsize = r->rlen));
+			memcpy(r->rest, b->buf + i + 1, r->rlen);
+			b->used = i + 1;
+		}
+
+		for (i = start = 0; i < b->used; i++)
+		{
+			if (b->buf[i] != '\n')
+				continue;
+			n = i - start;
+			if (n > 0 && b->buf[i-1] == '\r')
+				n--;
+			_batch_add(b, start, n, NULL);
+			start = i + 1;
+		}
+		if (start < b->used)
+			_batch_add(b, start, b->used - start, NULL);
+	}
+	else
+	{
+		/* whole files, at least one a batch */
+		for (start = r->next; r->next < r->nfile && (r->next == start || b->used < SIDX_BATCH_SIZE); r->next++)
+		{
+			struct stat st;
+
+			if (stat(r->files[r->next], &st) || !S_ISREG(st.st_mode) || st.st_size > 0x7fffffff)
+				continue;
+			if ((fp = fopen(r->files[r->next], "rb")) == NULL)
+				continue;
+			_batch_reserve(b, (int) st.st_size + 1);
+			n = fread(b->buf + b->used, 1, st.st_size, fp);
+			fclose(fp);
+			r->bytes += n;
+			_batch_add(b, b->used, n, r->files[r->next]);
+			b->used += n;
+		}
+	}
+
+	for (i = 0; i < b->num; i++)
+		b->docs[i] = b->buf + (size_t) b->docs[i];
+	return b->num;
+}
+
+static void *_batch_segment(void *arg)
+{
+	struct sidx_batch *b = (struct sidx_batch *) arg;
+
+	b->res = scws_segment_batch(b->s, b->docs, b->lens, b->num, b->threads);
+	return NULL;
+}
+
+static void batch_start(struct sidx_batch *b)
+{
+	b->res = NULL;
+	b->running = (xthread_create(&b->tid, _batch_segment, b) == 0);
+	if (!b->running)
+		_batch_segment(b);
+}
+
+static void batch_wait(struct sidx_batch *b)
+{
+	if (b->running)
+		xthread_join(b->tid);
+	b->running = 0;
+}
+
+static int do_build(scws_t s, const char *input, const char *output, int threads, int xmode)
+{
+	struct sidx_batch bats[2], *cur, *nxt, *tmp;
+	sidx_reader_t r;
+	sidx_t x;
+	int i, k, n;
+
+	if ((r = reader_open(input)) == NULL)
+	{
+		fprintf(stderr, "ERROR: input corpus open failed. '%s'\n", input);
+		return -1;
+	}
+
+	x = sidx_new();
+	memset(bats, 0, sizeof(bats));
+	cur = &bats[0];
+	nxt = &bats[1];
+	cur->s = nxt->s = s;
+	cur->threads = nxt->threads = threads;
+
+	/* read the next batch & index the last while the current is segmented */
+	n = reader_fill(r, cur);
+	if (n > 0)
+		batch_start(cur);
+	while (n > 0)
+	{
+		n = reader_fill(r, nxt);
+		batch_wait(cur);
+		if (n > 0)
+			batch_start(nxt);
+
+		for (i = 0; cur->res != NULL && i < cur->num; i++)
+		{
+			k = cur->res->index[i];
+			sidx_add_doc(x, cur->docs[i], k < cur->res->index[i+1] ? &cur->res->res[k] : NULL, cur->res->view + k,
+				cur->names[i]);
+		}
+		if (cur->res != NULL)
+			scws_free_batch(cur->res);
+
+		tmp = cur; cur = nxt; nxt = tmp;
+	}
+
+	i = sidx_save(x, output, r->fp != NULL ? SIDX_F_LINES : 0);
+	if (i != 0)
+		fprintf(stderr, "ERROR: index file write failed. '%s'\n", output);
+	else if (!(xmode & XMODE_NO_TIME))
+	{
+		fprintf(stderr, "| Docs:      %-10u          |\n", x->ndoc);
+		fprintf(stderr, "| Terms:     %-10d          |\n", x->num);
+		fprintf(stderr, "| Tokens:    %-10llu          |\n", x->ntoken);
+		fprintf(stderr, "| TextLen:   %-10llu          |\n", r->bytes);
+	}
+
+	for (n = 0; n < 2; n++)
+	{
+		free(bats[n].buf);
+		free(bats[n].docs);
+		free(bats[n].lens);
+		free(bats[n].names);
+	}
+	sidx_free(x);
+	reader_close(r);
+	return i;
+}
+
+/* query: the postings of a term decoded */
+struct sidx_plist
+{
+	unsigned int id;
+	unsigned int df;
+	unsigned int *docs;
+	unsigned int *tfs;
+	unsigned int *poff;		/* positions of docs[i]: pos[poff[i]] ~ pos[poff[i+1]-1] */
+	unsigned int *pos;
+	unsigned int cur;
+};
+
+static int _sidx_plist_load(FILE *fp, const struct sidx_term *t, struct sidx_plist *pl)
+{
+	const unsigned char *p, *end;
+	unsigned char *buf;
+	unsigned int i, j, doc, np, psize, v;
+
+	memset(pl, 0, sizeof(struct sidx_plist));
+	pl->id = t->id;
+	pl->df = t->df;
+	buf = (unsigned char *) malloc(t->len > 0 ? t->len : 1);
+	if (fseek(fp, (long) t->off, SEEK_SET) || fread(buf, 1, t->len, fp) != t->len)
+	{
+		free(buf);
+		return -1;
+	}
+
+	pl->docs = (unsigned int *) malloc(sizeof(unsigned int) * (t->df * 3 + 1));
+	pl->tfs = pl->docs + t->df;
+	pl->poff = pl->tfs + t->df;
+	psize = t->df * 2;
+	pl->pos = (unsigned int *) malloc(sizeof(unsigned int) * psize);
+	p = buf;
+	end = buf + t->len;
+	for (i = doc = np = 0; i < t->df && p < end; i++)
+	{
+		doc += _vbyte_get(&p, end);
+		pl->docs[i] = doc - 1;
+		pl->tfs[i] = _vbyte_get(&p, end);
+		pl->poff[i] = np;
+		for (j = v = 0; j < pl->tfs[i]; j++)
+		{
+			if (np == psize)
+				pl->pos = (unsigned int *) realloc(pl->pos, sizeof(unsigned int) * (psize <<= 1));
+			v += _vbyte_get(&p, end);
+			pl->pos[np++] = v;
+		}
+	}
+	pl->poff[i] = np;
+	pl->df = i;
+	free(buf);
+	return 0;
+}
+
+static int _sidx_has_pos(struct sidx_plist *pl, unsigned int k, unsigned int pos)
+{
+	unsigned int lo, hi, mid;
+
+	lo = pl->poff[k];
+	hi = pl->poff[k + 1];
+	while (lo < hi)
+	{
+		mid = (lo + hi) >> 1;
+		if (pl->pos[mid] == pos)
+			return 1;
+		if (pl->pos[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+struct sidx_hit
+{
+	unsigned int doc;
+	float score;
+};
+
+static int _cmp_hit(const void *a, const void *b)
+{
+	const struct sidx_hit *x = (const struct sidx_hit *) a, *y = (const struct sidx_hit *) b;
+
+	if (x->score != y->score)
+		return (x->score > y->score ? -1 : 1);
+	return (x->doc < y->doc ? -1 : (x->doc > y->doc ? 1 : 0));
+}
+
+#define	SIDX_MAX_QWORDS		64
+
+static int do_query(scws_t s, const char *query, const char *fpath, int phrase, int limit, FILE *fout)
+{
+	struct sidx_header hdr;
+	struct sidx_term *terms;
+	struct sidx_doc *docs;
+	struct sidx_plist pls[SIDX_MAX_QWORDS];
+	struct sidx_hit *hits;
+	scws_res_t res, cur;
+	FILE *fp;
+	char *names;
+	int qterm[SIDX_MAX_QWORDS], nq, nt, nhit, i, j, k, lo, hi, ok, ret = -1;
+	unsigned int d, p;
+	float score;
+
+	nq = nt = 0;
+	if ((fp = fopen(fpath, "rb")) == NULL)
+	{
+		fprintf(stderr, "ERROR: index file open failed. '%s'\n", fpath);
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, SIDX_MAGIC, 4) || hdr.version != SIDX_VERSION)
+	{
+		fprintf(stderr, "ERROR: not an index file. '%s'\n", fpath);
+		fclose(fp);
+		return -1;
+	}
+
+	terms = (struct sidx_term *) malloc(sizeof(struct sidx_term) * (hdr.nterm + 1));
+	docs = (struct sidx_doc *) malloc(sizeof(struct sidx_doc) * (hdr.ndoc + 1));
+	names = (char *) malloc(hdr.name_size + 1);
+	if (fseek(fp, (long) hdr.term_off, SEEK_SET)
+		|| fread(terms, sizeof(struct sidx_term), hdr.nterm, fp) != hdr.nterm
+		|| fread(docs, sizeof(struct sidx_doc), hdr.ndoc, fp) != hdr.ndoc
+		|| fread(names, 1, hdr.name_size, fp) != hdr.name_size)
+	{
+		fprintf(stderr, "ERROR: index file broken. '%s'\n", fpath);
+		goto query_end;
+	}
+	names[hdr.name_size] = '\0';
+
+	/* the words of the query, segmented as the docs */
+	scws_send_text(s, query, strlen(query));
+	while ((res = cur = scws_get_result(s)) != NULL)
+	{
+		for (; cur != NULL && nq < SIDX_MAX_QWORDS; cur = cur->next)
+		{
+			if (SIDX_SKIP_TOKEN(query, cur) || scws_res_view(cur) != SCWS_VIEW_BASE)
+				continue;
+			for (k = 0; k < nt && pls[k].id != cur->id; k++);
+			if (k == nt)
+			{
+				/* binary search the term table */
+				for (lo = 0, hi = hdr.nterm; lo < hi; )
+				{
+					i = (lo + hi) >> 1;
+					if (terms[i].id < cur->id)
+						lo = i + 1;
+					else
+						hi = i;
+				}
+				if (lo < (int) hdr.nterm && terms[lo].id == cur->id)
+				{
+					if (_sidx_plist_load(fp, &terms[lo], &pls[k]) != 0)
+						goto query_end;
+				}
+				else
+				{
+					memset(&pls[k], 0, sizeof(struct sidx_plist));
+					pls[k].id = cur->id;
+				}
+				nt++;
+			}
+			fprintf(fout, "%s%.*s(%u)", nq > 0 ? " " : "", cur->len, query + cur->off, pls[k].df);
+			qterm[nq++] = k;
+		}
+		scws_free_result(res);
+	}
+	fprintf(fout, "\n");
+
+	/* intersect all the lists by the shortest one */
+	nhit = 0;
+	hits = NULL;
+	for (k = j = 0; k < nt; k++)
+	{
+		if (pls[k].df < pls[j].df)
+			j = k;
+	}
+	if (nt > 0 && pls[j].df > 0)
+	{
+		hits = (struct sidx_hit *) malloc(sizeof(struct sidx_hit) * pls[j].df);
+		for (i = 0; i < (int) pls[j].df; i++)
+		{
+			d = pls[j].docs[i];
+			for (k = 0, ok = 1; ok && k < nt; k++)
+			{
+				while (pls[k].cur < pls[k].df && pls[k].docs[pls[k].cur] < d)
+					pls[k].cur++;
+				ok = (pls[k].cur < pls[k].df && pls[k].docs[pls[k].cur] == d);
+			}
+			if (!ok)
+				continue;
+
+			/* the words follow the first one at every position */
+			if (phrase && nq > 1)
+			{
+				k = qterm[0];
+				for (p = pls[k].poff[pls[k].cur], ok = 0; !ok && p < pls[k].poff[pls[k].cur + 1]; p++)
+				{
+					for (ok = 1, lo = 1; ok && lo < nq; lo++)
+						ok = _sidx_has_pos(&pls[qterm[lo]], pls[qterm[lo]].cur, pls[k].pos[p] + lo);
+				}
+				if (!ok)
+					continue;
+			}
+
+			for (k = 0, score = 0.0; k < nt; k++)
+				score += pls[k].tfs[pls[k].cur] * (float) log(1.0 + (double) hdr.ndoc / pls[k].df);
+			hits[nhit].doc = d;
+			hits[nhit++].score = score / (float) sqrt(1.0 + docs[d].ntok);
+		}
+	}
+
+	if (nhit > 1)
+		qsort(hits, nhit, sizeof(struct sidx_hit), _cmp_hit);
+	fprintf(fout, "Hits: %d of %u docs\n", nhit, hdr.ndoc);
+	fprintf(fout, "No. DocID       Score   Doc\n");
+	fprintf(fout, "-------------------------------------------------\n");
+	for (i = 0; i < nhit && (limit <= 0 || i < limit); i++)
+	{
+		d = hits[i].doc;
+		if (hdr.flags & SIDX_F_LINES)
+			fprintf(fout, "%02d. %-10u  %-6.3f  line %u\n", i + 1, d, hits[i].score, d + 1);
+		else
+			fprintf(fout, "%02d. %-10u  %-6.3f  %s\n", i + 1, d, hits[i].score, names + docs[d].name);
+	}
+	if (hits != NULL)
+		free(hits);
+	ret = 0;
+
+query_end:
+	for (k = 0; k < nt; k++)
+	{
+		if (pls[k].docs != NULL)
+		{
+			free(pls[k].docs);
+			free(pls[k].pos);
+		}
+	}
+	free(names);
+	free(docs);
+	free(terms);
+	fclose(fp);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int c, xmode, threads, phrase, limit, ret;
+	char *input, *output, *query, *icharset;
+	struct timeval t1, t2;
+	scws_t s;
+
+	input = output = query = icharset = NULL;
+	xmode = threads = phrase = ret = 0;
+	limit = 10;
+	if ((program_name = strrchr(argv[0], '/')) != NULL)
+		program_name++;
+	else
+		program_name = argv[0];
+
+	gettimeofday(&t1, NULL);
+	s = scws_new();
+	scws_set_ignore(s, SCWS_YEA);
+
+	/* parse the arguments */
+	while ((c = getopt(argc, argv, "i:o:q:n:c:C:r:d:M:T:pENvh")) != -1)
+	{
+		switch (c)
+		{
+			case 'i' :
+				input = optarg;
+				break;
+			case 'o' :
+				output = optarg;
+				break;
+			case 'q' :
+				query = optarg;
+				break;
+			case 'n' :
+				limit = atoi(optarg);
+				break;
+			case 'p' :
+				phrase = 1;
+				break;
+			case 'c' :
+				scws_set_charset(s, optarg);
+				break;
+			case 'C' :
+				icharset = optarg;
+				break;
+			case 'r' :
+				scws_set_rule(s, optarg);
+				if (s->r == NULL && !(xmode & XMODE_NO_TIME))
+					fprintf(stderr, "WARNING: input ruleset fpath load failed. '%s'\n", optarg);
+				break;
+			case 'd' :
+				{
+					char *d_str, *p_str, *q_str;
+					int dmode;
+					d_str = optarg;
+					do
+					{
+						if ((p_str = strchr(d_str, ':')) != NULL) *p_str++ = '\0';
+
+						dmode = (xmode & XMODE_DICT_MEM) ? SCWS_XDICT_MEM : SCWS_XDICT_XDB;
+						if ((q_str = strrchr(d_str, '.')) != NULL && !strcasecmp(q_str, ".txt"))
+							dmode |= SCWS_XDICT_TXT;
+						dmode = scws_add_dict(s, d_str, dmode);
+						if (dmode < 0 && !(xmode & XMODE_NO_TIME))
+							fprintf(stderr, "WARNING: failed to add dict file: %s\n", d_str);
+					}
+					while ((d_str = p_str) != NULL);
+				}
+				break;
+			case 'M' :
+				scws_set_multi(s, (atoi(optarg)<<12));
+				break;
+			case 'E' :
+				xmode |= XMODE_DICT_MEM;
+				break;
+			case 'N' :
+				xmode |= XMODE_NO_TIME;
+				break;
+			case 'T' :
+				threads = atoi(optarg);
+				break;
+			case 'v' :
+				printf("%s (%s/%s: Simpled Chinese Words Segment - Inverted index)\n",
+							program_name, PACKAGE_NAME, PACKAGE_VERSION);
+				exit(0);
+				break;
+			case 'h' :
+				show_usage(0, NULL);
+				break;
+			case '?' :
+			default :
+				exit(-1);
+		}
+	}
+
+	/* other arguments: the index */
+	if (optind < argc)
+	{
+		if (query != NULL || input != NULL)
+			output = argv[optind];
+		else
+			show_usage(-1, "Require the corpus by -i or the query by -q");
+	}
+	if (output == NULL)
+		output = "scws.idx";
+	if (icharset != NULL && scws_set_input_charset(s, icharset) != 0)
+	{
+		fprintf(stderr, "ERROR: input charset not convertible to the dict charset. '%s'\n", icharset);
+		scws_free(s);
+		return 1;
+	}
+
+	if (query != NULL)
+		ret = do_query(s, query, output, phrase, limit, stdout);
+	else if (input != NULL)
+	{
+		ret = do_build(s, input, output, threads, xmode);
+		if (ret == 0 && !(xmode & XMODE_NO_TIME))
+		{
+			gettimeofday(&t2, NULL);
+			fprintf(stderr, "| Time:      %-10.4f(sec)     |\n",
+							(t2.tv_sec - t1.tv_sec) + (float)(t2.tv_usec - t1.tv_usec)/1000000);
+		}
+	}
+	else
+		show_usage(-1, "Require the corpus by -i or the query by -q");
+
+	scws_free(s);
+	return (ret == 0 ? 0 : 1);
+}
@@ -5,11 +5,21 @@
  * $Id$
  */
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "compat.h"
 
 #include <stdio.h>
 #include <string.h>
 #include "charset.h"
+#include "xalloc.h"
+#include "xthread.h"
+
+#if !defined(_WIN32) && defined(HAVE_ICONV)
+#	include <iconv.h>
+#endif
 
 /* utf-8: 0xc0, 0xe0, 0xf0, 0xf8, 0xfc */
 static unsigned char _mblen_table_utf8[] = 
@@ -86,3 +96,167 @@ unsigned char *charset_table_get(const char *cs)
 
 	return _mblen_table_gbk;
 }
+
+/* 2-byte charsets convertible to utf-8, the table is built on the first use */
+struct conv_tab
+{
+	const char *name;
+	const char *iconv;	/* name for iconv_open */
+	unsigned int cp;	/* windows code page */
+	int slot;
+};
+
+static struct conv_tab conv_tab_list[] =
+{
+	{	"gbk",		"GBK",	936,	0	},
+	{	"gb2312",	"GBK",	936,	0	},
+	{	"big5",		"BIG5",	950,	1	},
+	{	"big-5",	"BIG5",	950,	1	},
+	{	NULL,		NULL,	0,		0	}
+};
+
+static unsigned short *volatile _conv_tables[2];
+
+#if defined(_WIN32) || defined(HAVE_ICONV)
+/* ask the system for each 2-byte code, return NULL if the charset is not supported */
+static unsigned short *_conv_build(struct conv_tab *ct)
+{
+	unsigned short *tab;
+	unsigned char buf[2];
+	int lead, trail;
+#if defined(_WIN32)
+	WCHAR wc;
+
+	if (!IsValidCodePage(ct->cp))
+		return NULL;
+#else
+	unsigned char out[4];
+	char *ip, *op;
+	size_t il, ol;
+	iconv_t cd;
+
+	if ((cd = iconv_open("UTF-16LE", ct->iconv)) == (iconv_t) -1)
+		return NULL;
+#endif
+
+	tab = (unsigned short *) xmalloc(sizeof(unsigned short) * 0x10000);
+	memset(tab, 0, sizeof(unsigned short) * 0x10000);
+	for (lead = 0x81; lead < 0xff; lead++)
+	{
+		for (trail = 0x40; trail < 0xff; trail++)
+		{
+			if (trail == 0x7f)
+				continue;
+			buf[0] = (unsigned char) lead;
+			buf[1] = (unsigned char) trail;
+#if defined(_WIN32)
+			if (MultiByteToWideChar(ct->cp, MB_ERR_INVALID_CHARS, (LPCSTR) buf, 2, &wc, 1) == 1 && wc >= 0x80)
+				tab[(lead << 8) | trail] = (unsigned short) wc;
+#else
+			ip = (char *) buf; il = 2;
+			op = (char *) out; ol = sizeof(out);
+			iconv(cd, NULL, NULL, NULL, NULL);
+			if (iconv(cd, &ip, &il, &op, &ol) != (size_t) -1 && il == 0 && ol == 2
+				&& (out[0] | (out[1] << 8)) >= 0x80 && (out[1] & 0xf8) != 0xd8)
+				tab[(lead << 8) | trail] = (unsigned short) (out[0] | (out[1] << 8));
+#endif
+		}
+	}
+#if !defined(_WIN32)
+	iconv_close(cd);
+#endif
+	return tab;
+}
+#else
+static unsigned short *_conv_build(struct conv_tab *ct)
+{
+	return NULL;
+}
+#endif
+
+const unsigned short *charset_conv_table(const char *cs)
+{
+	struct conv_tab *ct;
+	unsigned short *tab;
+
+	if (cs == NULL)
+		return NULL;
+
+	for (ct = conv_tab_list; ct->name != NULL; ct++)
+	{
+		if (!strcasecmp(ct->name, cs))
+			break;
+	}
+	if (ct->name == NULL)
+		return NULL;
+
+	/* built once for the process, the loser of a race drops its copy */
+	if ((tab = (unsigned short *) xthread_load_ptr((void *volatile *) &_conv_tables[ct->slot])) != NULL)
+		return tab;
+	if ((tab = _conv_build(ct)) == NULL)
+		return NULL;
+	if (!xthread_cas_ptr((void *volatile *) &_conv_tables[ct->slot], NULL, tab))
+	{
+		xfree(tab);
+		tab = (unsigned short *) xthread_load_ptr((void *volatile *) &_conv_tables[ct->slot]);
+	}
+	return tab;
+}
+
+int charset_conv_utf8(const unsigned short *tab, const unsigned char *mblen, const unsigned char *src, int len,
+	unsigned char *dst, int *omap)
+{
+	unsigned int c;
+	int i, n, k, clen;
+
+	for (i = n = 0; i < len; i += clen)
+	{
+		c = src[i];
+		clen = 1;
+		if (c >= 0x80)
+		{
+			/* U+FFFD for the bytes not mapped, a lead byte before an ascii one stands alone */
+			if (mblen[c] == 2 && (i + 1) < len && src[i+1] >= 0x40)
+			{
+				clen = 2;
+				c = tab[(c << 8) | src[i+1]];
+			}
+			else
+				c = 0;
+			if (c == 0)
+				c = 0xfffd;
+		}
+
+		k = (c < 0x80 ? 1 : (c < 0x800 ? 2 : 3));
+		if (dst != NULL)
+		{
+			if (k == 1)
+				dst[n] = (unsigned char) c;
+			else if (k == 2)
+			{
+				dst[n] = (unsigned char) (0xc0 | (c >> 6));
+				dst[n+1] = (unsigned char) (0x80 | (c & 0x3f));
+			}
+			else
+			{
+				dst[n] = (unsigned char) (0xe0 | (c >> 12));
+				dst[n+1] = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+				dst[n+2] = (unsigned char) (0x80 | (c & 0x3f));
+			}
+			if (omap != NULL)
+			{
+				omap[n] = i;
+				if (k > 1)
+				{
+					omap[n+1] = i;
+					if (k > 2)
+						omap[n+2] = i;
+				}
+			}
+		}
+		n += k;
+	}
+	if (dst != NULL && omap != NULL)
+		omap[n] = len;
+	return n;
+}
@@ -11,4 +11,30 @@
 /* api used to change the charset assocted */
 unsigned char *charset_table_get(const char *cs);
 
+/* dense index of a single char (< CHARSET_ZINDEX_MAX), unique for the key bytes:
+ * 2-byte chars (gbk, big5, utf-8 < U+0800) by their bytes, 3-byte utf-8 by the BMP codepoint.
+ * -1 for the others */
+#define	CHARSET_ZINDEX_MAX		0x20000
+
+static inline int charset_zindex(const unsigned char *key, int len)
+{
+	if (len == 2)
+		return (key[0] << 8) | key[1];
+	if (len == 3 && (key[0] & 0xf0) == 0xe0 && (key[1] & 0xc0) == 0x80 && (key[2] & 0xc0) == 0x80)
+		return 0x10000 | ((key[0] & 0x0f) << 12) | ((key[1] & 0x3f) << 6) | (key[2] & 0x3f);
+	return -1;
+}
+
+/* table-driven conversion of the 2-byte charsets (gbk, big5) to utf-8, so the
+ * dict & rules in utf-8 serve the text of them (see scws_set_input_charset). the table maps the
+ * code (lead << 8 | trail) to its BMP codepoint (0: none), built once from the system (iconv or
+ * the windows code page). NULL if the charset is not convertible */
+const unsigned short *charset_conv_table(const char *cs);
+
+/* convert len bytes of src (mblen: the table of its charset) into dst, the bytes not mapped become
+ * U+FFFD. omap[k] is the offset in src of dst[k], omap[ret] = len. dst = NULL: only count.
+ * return the utf-8 length (3 * len at most) */
+int charset_conv_utf8(const unsigned short *tab, const unsigned char *mblen, const unsigned char *src, int len,
+	unsigned char *dst, int *omap);
+
 #endif
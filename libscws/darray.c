@@ -6,6 +6,7 @@
  */
 
 #include "darray.h"
+#include "xalloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,7 +15,7 @@ void **darray_new(int row, int col, int size)
 {	
 	void **arr;
 
-	arr = (void **) malloc(sizeof(void *) * row + size * row * col);
+	arr = (void **) xmalloc(sizeof(void *) * row + size * row * col);
 	if (arr != NULL)
 	{
 		void *head;
@@ -30,6 +31,6 @@ void **darray_new(int row, int col, int size)
 void darray_free(void **arr)
 {
 	if (arr != NULL)
-		free(arr);	
+		xfree(arr);	
 }
 
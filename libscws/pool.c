@@ -5,6 +5,10 @@
  * $Id$
  */
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include "compat.h"
 
 #include "pool.h"
@@ -12,90 +16,212 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_MMAP
+#	include <sys/mman.h>
+#	if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#		define	MAP_ANONYMOUS	MAP_ANON
+#	endif
+#endif
+
+#define	POOL_HEAD_SIZ	(sizeof(struct pheap))
+
 /** pool memory management */
-static void _pool_append_clean(pool_t p, void *obj)
+static struct pheap *_pool_block_alloc(pool_t p, scws_max_size_t total)
+{
+	struct pheap *h = NULL;
+	int type = 0;
+
+#if defined(HAVE_MMAP) && defined(MAP_ANONYMOUS)
+	// big blocks on huge pages, MAP_HUGETLB needs reserved pages,
+	// else ask for transparent ones
+	if ((p->flags & POOL_HUGEPAGE) && total >= POOL_HUGE_SIZ)
+	{
+		void *m;
+
+		total = (total + POOL_HUGE_SIZ - 1) & ~((scws_max_size_t) POOL_HUGE_SIZ - 1);
+#ifdef MAP_HUGETLB
+		m = mmap(NULL, total, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if (m == MAP_FAILED)
+#endif
+		{
+			m = mmap(NULL, total, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+			if (m != MAP_FAILED)
+				madvise(m, total, MADV_HUGEPAGE);
+#endif
+		}
+		if (m != MAP_FAILED)
+		{
+			h = (struct pheap *) m;
+			type = 1;
+		}
+	}
+#endif
+
+	if (h == NULL && (h = (struct pheap *) xmalloc_a(p->alloc, total)) == NULL)
+		return NULL;
+
+	h->size = total - POOL_HEAD_SIZ;
+	h->used = 0;
+	h->type = type;
+	p->size += total;
+	p->blocks++;
+	return h;
+}
+
+static void _pool_block_free(pool_t p, struct pheap *h)
 {
-	struct pclean *c;
+#ifdef HAVE_MMAP
+	if (h->type == 1)
+	{
+		munmap((void *) h, h->size + POOL_HEAD_SIZ);
+		return;
+	}
+#endif
+	xfree_a(p->alloc, h);
+}
 
-	p->size += sizeof(struct pclean);
-	c = (struct pclean *) malloc(sizeof(struct pclean));
-	c->obj = obj;
-	c->nxt = p->clean;
-	p->clean = c;
+/* a block with need bytes free at least: the best fitting spare one, or a new one of total */
+static struct pheap *_pool_block_get(pool_t p, scws_max_size_t need, scws_max_size_t total)
+{
+	struct pheap *h, **pp, **best;
+
+	for (best = NULL, pp = &p->spare; (h = *pp) != NULL; pp = &h->nxt)
+	{
+		if (h->size >= need && (best == NULL || h->size < (*best)->size))
+			best = pp;
+	}
+	if (best != NULL)
+	{
+		h = *best;
+		*best = h->nxt;
+		return h;
+	}
+	return _pool_block_alloc(p, total);
 }
 
-static void _pool_heap_new(pool_t p)
+/* new current block, the blocks are doubled up to blk_max */
+static struct pheap *_pool_heap_new(pool_t p, scws_max_size_t need)
 {
-	if (p->heap != NULL)	
+	struct pheap *h;
+
+	if ((h = _pool_block_get(p, need, p->blk_size)) == NULL)
+		return NULL;
+	if (p->blk_size < p->blk_max)
+		p->blk_size <<= 1;
+	if (p->heap != NULL)
 		p->dirty += (p->heap->size - p->heap->used);
-	
-	p->heap = (struct pheap *) malloc(POOL_BLK_SIZ);
-	p->heap->size = POOL_BLK_SIZ - sizeof(struct pheap);
-	p->heap->used = 0;
-	p->size += POOL_BLK_SIZ;
 
-	_pool_append_clean(p, (void *) p->heap);
+	h->nxt = p->heap;
+	p->heap = h;
+	return h;
 }
 
+/* big request, the block of its own (size class: power of 2) is put after the current */
+static void *_pool_big_new(pool_t p, scws_max_size_t size)
+{
+	struct pheap *h;
+	scws_max_size_t total;
 
-pool_t pool_new()
-{	
+	for (total = p->blk_size; total < (size + POOL_HEAD_SIZ + POOL_ALIGN); total <<= 1);
+	if ((h = _pool_block_get(p, size + POOL_ALIGN, total)) == NULL)
+		return NULL;
+
+	h->used = h->size;
+	p->dirty += (h->size - size);
+	if (p->heap == NULL)
+	{
+		h->nxt = NULL;
+		p->heap = h;
+	}
+	else
+	{
+		h->nxt = p->heap->nxt;
+		p->heap->nxt = h;
+	}
+	return (void *) (((size_t) h->block + POOL_ALIGN - 1) & ~((size_t) POOL_ALIGN - 1));
+}
+
+pool_t pool_new_ex(scws_max_size_t init, scws_max_size_t max, int flags)
+{
 	pool_t p;
+	scws_max_size_t size;
 
-	p = (pool_t) malloc(sizeof(pool_st));
+	p = (pool_t) xmalloc(sizeof(pool_st));
+	memset(p, 0, sizeof(pool_st));
 	p->size = sizeof(pool_st);
-	p->dirty = 0;
-	p->heap = NULL;
-	p->clean = NULL;
-	_pool_heap_new(p);
+	for (size = 256; size < init; size <<= 1);
+	p->blk_size = size;
+	p->blk_max = (max > size ? max : size);
+	p->flags = flags;
 	return p;
 }
 
-void pool_free(pool_t p)
+pool_t pool_new()
+{	
+	return pool_new_ex(POOL_BLK_SIZ, POOL_BLK_MAX, 0);
+}
+
+void pool_reset(pool_t p)
 {
-	struct pclean *cur, *nxt;
-	
-	cur = p->clean;
-	while (cur != NULL)
+	struct pheap *h;
+
+	while ((h = p->heap) != NULL)
 	{
-		free(cur->obj);
-		nxt = cur->nxt;
-		free(cur);
-		cur = nxt;
+		p->heap = h->nxt;
+		h->used = 0;
+		h->nxt = p->spare;
+		p->spare = h;
 	}
-	free(p);
+	p->used = p->dirty = 0;
 }
 
-void *pmalloc(pool_t p, scws_max_size_t size)
+void pool_free(pool_t p)
 {
-	void *block;
+	struct pheap *h;
 
-	/* big request */
-	if (size > (p->heap->size / 4))
+	pool_reset(p);
+	while ((h = p->spare) != NULL)
 	{
-		block = malloc(size);
-		p->size += size;
-		_pool_append_clean(p, block);
-		return block;
+		p->spare = h->nxt;
+		_pool_block_free(p, h);
 	}
+	xfree(p);
+}
+
+void *pmalloc(pool_t p, scws_max_size_t size)
+{
+	struct pheap *h;
+	scws_max_size_t pad, align;
 
-	/* memory align (>=4) */
-	if (size & 0x04)
+	/* memory align: the lowest bit of size, objects are multiple of their alignment */
+	align = (size & -size);
+	if (align == 0 || align > POOL_ALIGN)
+		align = POOL_ALIGN;
+
+	p->used += size;
+	if ((h = p->heap) != NULL)
 	{
-		while (p->heap->used & 0x03)
+		pad = (0 - (size_t) (h->block + h->used)) & (align - 1);
+		if ((pad + size) <= (h->size - h->used))
 		{
-			p->dirty++;
-			p->heap->used++;
-		}		
+			p->dirty += pad;
+			h->used += pad + size;
+			return (void *) (h->block + h->used - size);
+		}
 	}
 
-	/* not enough? */
-	if (size > (p->heap->size - p->heap->used))	
-		_pool_heap_new(p);
-	
-	block = (void *)((char *) p->heap->block + p->heap->used);
-	p->heap->used += size;
-	return block;
+	/* big request */
+	if (size > (p->blk_size / 4))
+		return _pool_big_new(p, size);
+
+	/* not enough, blocks start aligned to POOL_ALIGN at least (by malloc) */
+	if ((h = _pool_heap_new(p, size + POOL_ALIGN)) == NULL)
+		return NULL;
+	pad = (0 - (size_t) h->block) & (align - 1);
+	p->dirty += pad;
+	h->used = pad + size;
+	return (void *) (h->block + pad);
 }
 
 void *pmalloc_x(pool_t p, scws_max_size_t size, char c)
@@ -137,4 +263,3 @@ char *pstrndup(pool_t p, const char *src, scws_max_size_t len)
 
 	return dst;
 }
-
@@ -9,38 +9,51 @@
 #define	_SCWS_POOL_20070525_H_
 
 #include "xsize.h"
+#include "xalloc.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* block size for pool */
+/* block size for pool: the first one, the ceiling of growth (doubled per block) */
 #define	POOL_BLK_SIZ	4096
+#define	POOL_BLK_MAX	(1 << 20)
+
+/* max alignment, a request of size n is aligned to the lowest bit of n (up to this) */
+#define	POOL_ALIGN		16
+
+/* flags: blocks >= POOL_HUGE_SIZ are mapped on huge pages (if the system can) */
+#define	POOL_HUGEPAGE	0x01
+#define	POOL_HUGE_SIZ	(2 << 20)
 
 /* data structure for pool */
 struct pheap
 {
 	scws_max_size_t size;
 	scws_max_size_t used;
+	struct pheap *nxt;
+	scws_max_size_t type;	/* 0: malloc, 1: mmap (word sized, block[] starts aligned) */
 	char block[0];
 };
 
-struct pclean
-{
-	void *obj;
-	struct pclean *nxt;
-};
-
 typedef struct
 {
-	scws_max_size_t size;			/* total allocated */
-	scws_max_size_t dirty;			/* total wasted */
-	struct pheap *heap;	
-	struct pclean *clean;
+	scws_max_size_t size;			/* total allocated (blocks & the pool) */
+	scws_max_size_t used;			/* total given by pmalloc */
+	scws_max_size_t dirty;			/* total wasted (padding & tails of blocks) */
+	scws_max_size_t blk_size;		/* size of the next block */
+	scws_max_size_t blk_max;		/* ceiling of blk_size */
+	int flags;
+	int blocks;						/* number of blocks (in use & spare) */
+	const xalloc_st *alloc;			/* allocator of the blocks, NULL: the global one */
+	struct pheap *heap;				/* current block, the full ones follow it */
+	struct pheap *spare;			/* blocks kept by pool_reset */
 }	pool_st, *pool_t;
 
 /* pool: api */
 pool_t pool_new();								/* create a new memory pool with an initial heap size */
+pool_t pool_new_ex(scws_max_size_t init, scws_max_size_t max, int flags);	/* blocks grow from init to max */
+void pool_reset(pool_t p);						/* drops all the data but keeps the blocks for reuse */
 void pool_free(pool_t p);						/* frees all the data on the pool & delete the pool itself */
 void *pmalloc(pool_t p, scws_max_size_t size);			/* wrapper around malloc, takes from the pool */
 void *pmalloc_x(pool_t p, scws_max_size_t size, char c);	/* wrapper around pmalloc which prefills buffer with c */
@@ -12,9 +12,69 @@
 #include "compat.h"
 
 #include "rule.h"
+#include "xthread.h"
+#include "charset.h"
+#include "xalloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+
+#ifdef HAVE_MMAP
+#   include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#	define	O_BINARY	0
+#endif
+
+/* compiled image, native byte order like xdb.
+ * header + items[SCWS_RULE_MAX] + disp[nbucket] + slot[nslot] + attr[nattr] + keys
+ * a word is at slot[hash(key, disp[hash(key, 0) % nbucket]) % nslot] (hash & displace) */
+#define	RULE_BIN_MAGIC		"SCWR"
+#define	RULE_BIN_VERSION	1
+#define	RULE_BIN_TRIES		0x100000
+
+struct rule_bin_header
+{
+	char magic[4];
+	int version;
+	int size;		/* whole file */
+	int isize;		/* sizeof(struct scws_rule_item) */
+	int nword;
+	int nbucket;
+	int nslot;
+	int nattr;
+	int off_disp;
+	int off_slot;
+	int off_attr;
+	int off_key;
+};
+
+struct rule_bin_slot
+{
+	unsigned int koff;
+	unsigned short klen;	/* 0: empty */
+	unsigned char item;
+	unsigned char unused;
+};
+
+/* same as the head of struct scws_rule_attr */
+struct rule_bin_attr
+{
+	char attr1[2];
+	char attr2[2];
+	unsigned char npath[2];
+	short ratio;
+};
+
+#define	RULE_BIN(r)				((struct rule_bin_header *) (r)->bin)
+#define	RULE_BIN_PTR(r,o)		((char *) (r)->bin + RULE_BIN(r)->o)
+
+#define	RULE_ITEMS(r)			((r)->bin != NULL ? (rule_item_t) ((char *) (r)->bin + sizeof(struct rule_bin_header)) : (r)->items)
+
+static void _rule_attr_compile(rule_t r);
+static void _rule_ztab_build(rule_t r);
 
 static inline int _rule_index_get(rule_t r, const char *name)
 {
@@ -30,6 +90,104 @@ static inline int _rule_index_get(rule_t r, const char *name)
 	return -1;
 }
 
+/* fnv-1a with a seed, then mixed */
+static inline unsigned int _rule_hash(const unsigned char *s, int len, unsigned int seed)
+{
+	unsigned int h = 2166136261U ^ seed;
+
+	while (len--)
+	{
+		h ^= *s++;
+		h *= 16777619U;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+static rule_item_t _rule_bin_get(rule_t r, const char *str, int len)
+{
+	struct rule_bin_header *hdr = RULE_BIN(r);
+	struct rule_bin_slot *slot;
+	unsigned int d;
+
+	if (len <= 0)
+		return NULL;
+	d = ((unsigned int *) RULE_BIN_PTR(r, off_disp))[_rule_hash((const unsigned char *) str, len, 0) % hdr->nbucket];
+	slot = (struct rule_bin_slot *) RULE_BIN_PTR(r, off_slot) + (_rule_hash((const unsigned char *) str, len, d) % hdr->nslot);
+	if (slot->klen != len || memcmp(RULE_BIN_PTR(r, off_key) + slot->koff, str, len))
+		return NULL;
+	return RULE_ITEMS(r) + slot->item;
+}
+
+/* map the compiled image, NULL if it is broken */
+static rule_t _rule_bin_open(const char *fpath)
+{
+	struct rule_bin_header *hdr;
+	struct rule_bin_slot *slot;
+	struct stat st;
+	rule_t r;
+	int fd, i;
+
+	if ((fd = open(fpath, O_RDONLY | O_BINARY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < (off_t) sizeof(struct rule_bin_header)
+		|| st.st_size > 0x7fffffff)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	r = (rule_t) xmalloc(sizeof(rule_st));
+	memset(r, 0, sizeof(rule_st));
+	r->ref = 1;
+	r->bin_size = (int) st.st_size;
+#ifdef HAVE_MMAP
+	if ((r->bin = mmap(NULL, r->bin_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		r->bin = NULL;
+	else
+		r->bin_type = 1;
+#endif
+	if (r->bin == NULL)
+	{
+		r->bin = xmalloc(r->bin_size);
+		r->bin_type = 2;
+		if (read(fd, r->bin, r->bin_size) != r->bin_size)
+			r->bin_size = 0;
+	}
+	close(fd);
+
+	/* check the header & the bounds */
+	hdr = RULE_BIN(r);
+	if (r->bin_size == 0 || memcmp(hdr->magic, RULE_BIN_MAGIC, 4) || hdr->version != RULE_BIN_VERSION
+		|| hdr->size != r->bin_size || hdr->isize != (int) sizeof(struct scws_rule_item)
+		|| hdr->nbucket <= 0 || hdr->nslot <= 0 || hdr->nword < 0 || hdr->nattr < 0
+		|| hdr->off_disp != (int) (sizeof(struct rule_bin_header) + sizeof(struct scws_rule_item) * SCWS_RULE_MAX)
+		|| hdr->off_slot != hdr->off_disp + (int) sizeof(unsigned int) * hdr->nbucket
+		|| hdr->off_attr != hdr->off_slot + (int) sizeof(struct rule_bin_slot) * hdr->nslot
+		|| hdr->off_key != hdr->off_attr + (int) sizeof(struct rule_bin_attr) * hdr->nattr
+		|| hdr->off_key > hdr->size)
+	{
+		scws_rule_free(r);
+		return NULL;
+	}
+	slot = (struct rule_bin_slot *) RULE_BIN_PTR(r, off_slot);
+	for (i = 0; i < hdr->nslot; i++)
+	{
+		if (slot[i].item >= SCWS_RULE_MAX || slot[i].koff + slot[i].klen > (unsigned int) (hdr->size - hdr->off_key))
+		{
+			scws_rule_free(r);
+			return NULL;
+		}
+	}
+	_rule_attr_compile(r);
+	_rule_ztab_build(r);
+	return r;
+}
+
 rule_t scws_rule_new(const char *fpath, unsigned char *mblen)
 {
 	FILE *fp;
@@ -43,8 +201,16 @@ rule_t scws_rule_new(const char *fpath, unsigned char *mblen)
 	if ((fp = fopen(fpath, "r")) == NULL)
 		return NULL;
 
+	/* compiled image? */
+	if (fread(buf, 1, 4, fp) == 4 && !memcmp(buf, RULE_BIN_MAGIC, 4))
+	{
+		fclose(fp);
+		return _rule_bin_open(fpath);
+	}
+	rewind(fp);
+
 	/* alloc the memory */
-	r = (rule_t) malloc(sizeof(rule_st));
+	r = (rule_t) xmalloc(sizeof(rule_st));
 	memset(r, 0, sizeof(rule_st));
 	r->ref = 1;
 
@@ -85,7 +251,7 @@ rule_t scws_rule_new(const char *fpath, unsigned char *mblen)
 	/* load the tree data */
 	if ((r->tree = xtree_new(0, 1)) == NULL)
 	{
-		free(r);
+		xfree(r);
 		return NULL;
 	}
 	cr = NULL;
@@ -127,7 +293,7 @@ rule_t scws_rule_new(const char *fpath, unsigned char *mblen)
 			*qtr++ = '\0';
 
 			/* create new memory */
-			a = (rule_attr_t) malloc(sizeof(struct scws_rule_attr));
+			a = (rule_attr_t) xmalloc(sizeof(struct scws_rule_attr));
 			memset(a, 0, sizeof(struct scws_rule_attr));
 
 			/* get ratio */
@@ -304,14 +470,265 @@ rule_t scws_rule_new(const char *fpath, unsigned char *mblen)
 
 	/* optimize the tree */
 	xtree_optimize(r->tree);
+	_rule_attr_compile(r);
+	_rule_ztab_build(r);
 	return r;
 }
 
+/* a word of the ruleset for the compiler */
+struct rule_bin_word
+{
+	const char *key;
+	int len;
+	int item;
+	int bucket;
+};
+
+static void _rule_bin_words(node_t node, rule_t r, struct rule_bin_word *w, int *num)
+{
+	if (node == NULL)
+		return;
+	if (node->value != NULL)
+	{
+		w[*num].key = node->key;
+		w[*num].len = (int) strlen(node->key);
+		w[*num].item = (int) ((rule_item_t) node->value - r->items);
+		(*num)++;
+	}
+	_rule_bin_words(node->left, r, w, num);
+	_rule_bin_words(node->right, r, w, num);
+}
+
+static int _rule_bin_count(node_t node)
+{
+	return (node == NULL ? 0 : 1 + _rule_bin_count(node->left) + _rule_bin_count(node->right));
+}
+
+static int _rule_bin_word_cmp(const void *a, const void *b)
+{
+	return ((struct rule_bin_word *) a)->bucket - ((struct rule_bin_word *) b)->bucket;
+}
+
+/* buckets: [0]=bucket id, [1]=first word, [2]=size, larger first */
+static int _rule_bin_bucket_cmp(const void *a, const void *b)
+{
+	const int *x = (const int *) a, *y = (const int *) b;
+	return (x[2] != y[2] ? y[2] - x[2] : x[0] - y[0]);
+}
+
+int scws_rule_compile(rule_t r, const char *fpath)
+{
+	struct rule_bin_header hdr;
+	struct rule_bin_word *words;
+	struct rule_bin_slot *slots;
+	struct rule_bin_attr *attrs;
+	rule_attr_t a;
+	unsigned int *disp;
+	int *buckets, *used, *owner, i, j, k, n, koff, ret;
+	FILE *fp;
+
+	if (r == NULL)
+		return -1;
+
+	/* collect the words */
+	memset(&hdr, 0, sizeof(hdr));
+	if (r->bin != NULL)
+	{
+		struct rule_bin_slot *s = (struct rule_bin_slot *) RULE_BIN_PTR(r, off_slot);
+
+		words = (struct rule_bin_word *) xmalloc(sizeof(struct rule_bin_word) * (RULE_BIN(r)->nword + 1));
+		for (i = n = 0; i < RULE_BIN(r)->nslot; i++)
+		{
+			if (s[i].klen == 0)
+				continue;
+			words[n].key = RULE_BIN_PTR(r, off_key) + s[i].koff;
+			words[n].len = s[i].klen;
+			words[n].item = s[i].item;
+			n++;
+		}
+	}
+	else
+	{
+		for (i = n = 0; i < (int) r->tree->prime; i++)
+			n += _rule_bin_count(r->tree->trees[i]);
+		words = (struct rule_bin_word *) xmalloc(sizeof(struct rule_bin_word) * (n + 1));
+		for (i = n = 0; i < (int) r->tree->prime; i++)
+			_rule_bin_words(r->tree->trees[i], r, words, &n);
+	}
+	hdr.nword = n;
+	hdr.nbucket = (n >> 2) + 1;
+	hdr.nslot = n + (n >> 2) + 1;
+
+	/* the buckets, larger ones are placed first */
+	for (i = 0; i < n; i++)
+		words[i].bucket = (int) (_rule_hash((const unsigned char *) words[i].key, words[i].len, 0) % hdr.nbucket);
+	qsort(words, n, sizeof(struct rule_bin_word), _rule_bin_word_cmp);
+	buckets = (int *) xmalloc(sizeof(int) * 3 * hdr.nbucket);
+	for (i = j = 0; i < hdr.nbucket; i++)
+	{
+		buckets[i*3] = i;
+		buckets[i*3+1] = j;
+		while (j < n && words[j].bucket == i) j++;
+		buckets[i*3+2] = j - buckets[i*3+1];
+	}
+	qsort(buckets, hdr.nbucket, sizeof(int) * 3, _rule_bin_bucket_cmp);
+
+	/* find a displacement of each bucket that puts its words into free slots */
+	disp = (unsigned int *) xcalloc(hdr.nbucket, sizeof(unsigned int));
+	slots = (struct rule_bin_slot *) xcalloc(hdr.nslot, sizeof(struct rule_bin_slot));
+	used = (int *) xmalloc(sizeof(int) * (n + 1));
+	owner = (int *) xmalloc(sizeof(int) * hdr.nslot);
+	ret = 0;
+	for (i = 0; i < hdr.nbucket && buckets[i*3+2] > 0; i++)
+	{
+		struct rule_bin_word *w = &words[buckets[i*3+1]];
+		unsigned int d;
+
+		for (d = 1; d < RULE_BIN_TRIES; d++)
+		{
+			for (j = 0; j < buckets[i*3+2]; j++)
+			{
+				used[j] = (int) (_rule_hash((const unsigned char *) w[j].key, w[j].len, d) % hdr.nslot);
+				if (slots[used[j]].klen != 0)
+					break;
+				for (k = 0; k < j && used[k] != used[j]; k++);
+				if (k < j)
+					break;
+			}
+			if (j == buckets[i*3+2])
+				break;
+		}
+		if (d == RULE_BIN_TRIES)
+		{
+			ret = -1;
+			break;
+		}
+		disp[buckets[i*3]] = d;
+		for (j = 0; j < buckets[i*3+2]; j++)
+		{
+			slots[used[j]].klen = (unsigned short) w[j].len;
+			slots[used[j]].item = (unsigned char) w[j].item;
+			owner[used[j]] = buckets[i*3+1] + j;
+		}
+	}
+
+	/* key offsets in slot order */
+	for (i = koff = 0; ret == 0 && i < hdr.nslot; i++)
+	{
+		if (slots[i].klen == 0)
+			continue;
+		slots[i].koff = koff;
+		koff += slots[i].klen;
+	}
+
+	/* attrs in the chain order */
+	for (a = r->attr, hdr.nattr = 0; a != NULL; a = a->next)
+		hdr.nattr++;
+	if (r->bin != NULL)
+		hdr.nattr = RULE_BIN(r)->nattr;
+	attrs = (struct rule_bin_attr *) xcalloc(hdr.nattr + 1, sizeof(struct rule_bin_attr));
+	if (r->bin != NULL)
+		memcpy(attrs, RULE_BIN_PTR(r, off_attr), sizeof(struct rule_bin_attr) * hdr.nattr);
+	for (a = r->attr, i = 0; a != NULL; a = a->next, i++)
+		memcpy(&attrs[i], a, sizeof(struct rule_bin_attr));
+
+	memcpy(hdr.magic, RULE_BIN_MAGIC, 4);
+	hdr.version = RULE_BIN_VERSION;
+	hdr.isize = (int) sizeof(struct scws_rule_item);
+	hdr.off_disp = (int) (sizeof(struct rule_bin_header) + sizeof(struct scws_rule_item) * SCWS_RULE_MAX);
+	hdr.off_slot = hdr.off_disp + (int) sizeof(unsigned int) * hdr.nbucket;
+	hdr.off_attr = hdr.off_slot + (int) sizeof(struct rule_bin_slot) * hdr.nslot;
+	hdr.off_key = hdr.off_attr + (int) sizeof(struct rule_bin_attr) * hdr.nattr;
+	hdr.size = hdr.off_key + koff;
+
+	if (ret == 0 && (fp = fopen(fpath, "wb")) != NULL)
+	{
+		fwrite(&hdr, sizeof(hdr), 1, fp);
+		if (r->bin != NULL)
+			fwrite((char *) r->bin + sizeof(struct rule_bin_header), sizeof(struct scws_rule_item), SCWS_RULE_MAX, fp);
+		else
+			fwrite(r->items, sizeof(struct scws_rule_item), SCWS_RULE_MAX, fp);
+		fwrite(disp, sizeof(unsigned int), hdr.nbucket, fp);
+		fwrite(slots, sizeof(struct rule_bin_slot), hdr.nslot, fp);
+		fwrite(attrs, sizeof(struct rule_bin_attr), hdr.nattr, fp);
+		for (i = 0; i < hdr.nslot; i++)
+		{
+			if (slots[i].klen != 0)
+				fwrite(words[owner[i]].key, slots[i].klen, 1, fp);
+		}
+		ret = ferror(fp) ? -1 : 0;
+		fclose(fp);
+	}
+	else
+		ret = -1;
+
+	xfree(attrs);
+	xfree(owner);
+	xfree(used);
+	xfree(slots);
+	xfree(disp);
+	xfree(buckets);
+	xfree(words);
+	return ret;
+}
+
+/* direct-indexed table of the single-char words */
+static void _rule_ztab_node(rule_t r, node_t node)
+{
+	int i;
+
+	if (node == NULL)
+		return;
+	if (node->value != NULL && (i = charset_zindex((unsigned char *) node->key, (int) strlen(node->key))) >= 0)
+	{
+		if (r->ztab == NULL)
+			r->ztab = (unsigned char *) xcalloc(CHARSET_ZINDEX_MAX, 1);
+		r->ztab[i] = (unsigned char) ((rule_item_t) node->value - r->items) + 1;
+	}
+	_rule_ztab_node(r, node->left);
+	_rule_ztab_node(r, node->right);
+}
+
+static void _rule_ztab_build(rule_t r)
+{
+	struct rule_bin_slot *slot;
+	int i, k;
+
+	if (r->bin == NULL)
+	{
+		for (i = 0; i < (int) r->tree->prime; i++)
+			_rule_ztab_node(r, r->tree->trees[i]);
+		return;
+	}
+
+	slot = (struct rule_bin_slot *) RULE_BIN_PTR(r, off_slot);
+	for (i = 0; i < RULE_BIN(r)->nslot; i++)
+	{
+		if (slot[i].klen == 0 || (k = charset_zindex((unsigned char *) RULE_BIN_PTR(r, off_key) + slot[i].koff, slot[i].klen)) < 0)
+			continue;
+		if (r->ztab == NULL)
+			r->ztab = (unsigned char *) xcalloc(CHARSET_ZINDEX_MAX, 1);
+		r->ztab[k] = slot[i].item + 1;
+	}
+}
+
+/* find the word */
+static inline rule_item_t _rule_find(rule_t r, const char *str, int len)
+{
+	int i;
+
+	if (r->ztab != NULL && (i = charset_zindex((const unsigned char *) str, len)) >= 0)
+		return (r->ztab[i] ? RULE_ITEMS(r) + (r->ztab[i] - 1) : NULL);
+	if (r->bin != NULL)
+		return _rule_bin_get(r, str, len);
+	return (rule_item_t) xtree_nget(r->tree, str, len, NULL);
+}
+
 /* fork rule */
 rule_t scws_rule_fork(rule_t r)
 {
 	if (r != NULL)
-		r->ref++;
+		xthread_atomic_add(&r->ref, 1);
 	return r;
 }
 
@@ -320,20 +737,35 @@ void scws_rule_free(rule_t r)
 {
 	if (r)
 	{
-		r->ref--;
-		if (r->ref == 0)
+		if (xthread_atomic_add(&r->ref, -1) == 0)
 		{
 			rule_attr_t a, b;
 
-			xtree_free(r->tree);
+			if (r->bin != NULL)
+			{
+#ifdef HAVE_MMAP
+				if (r->bin_type == 1)
+					munmap(r->bin, r->bin_size);
+				else
+#endif
+					xfree(r->bin);
+			}
+			if (r->tree != NULL)
+				xtree_free(r->tree);
+			if (r->acls != NULL)
+				xfree(r->acls);
+			if (r->amat != NULL)
+				xfree(r->amat);
+			if (r->ztab != NULL)
+				xfree(r->ztab);
 			a = r->attr;
 			while (a != NULL)
 			{
 				b = a;
 				a = b->next;
-				free(b);
+				xfree(b);
 			}
-			free(r);
+			xfree(r);
 		}
 	}
 }
@@ -344,7 +776,7 @@ rule_item_t scws_rule_get(rule_t r, const char *str, int len)
 	if (!r)
 		return NULL;
 
-	return((rule_item_t) xtree_nget(r->tree, str, len, NULL));
+	return _rule_find(r, str, len);
 }
 
 /* check the bit with str */
@@ -355,7 +787,7 @@ int scws_rule_checkbit(rule_t r, const char *str, int len, unsigned int bit)
 	if (!r)
 		return 0;
 
-	ri = (rule_item_t) xtree_nget(r->tree, str, len, NULL);
+	ri = _rule_find(r, str, len);
 	if ((ri != NULL) && (ri->bit & bit))
 		return 1;
 
@@ -366,11 +798,183 @@ int scws_rule_checkbit(rule_t r, const char *str, int len, unsigned int bit)
 #define	EQUAL_RULE_ATTR(x,y)	((y[0]=='*'||y[0]==x[0])&&(y[1]=='\0'||y[1]==x[1]))
 #define	EQUAL_RULE_NPATH(x,y)	((y[0]==0xff||y[0]==x[0])&&(y[1]==0xff||y[1]==x[1]))
 
+/* the ratio matrix. an ascii attr is interned to the class of the attrs
+ * matching the same rules (by attr[0], attr[1] only matters if some rule names it),
+ * a npath value to the class of the value in the rules, 0 for the others */
+#define	RULE_ACODE(a)			((((a)[0] & 0x7f) << 7) | ((a)[1] & 0x7f))
+#define	RULE_ACLS_MAX			255
+#define	RULE_NCLS_MAX			8
+
+/* class of the attr a0/a1, -1 if too many */
+static int _rule_attr_class(rule_t r, struct rule_bin_attr *list, int n, unsigned char *sig, int ssize, char rep[][2], int a0, int a1)
+{
+	unsigned char *me = sig + RULE_ACLS_MAX * ssize;
+	char x[2];
+	int i, c;
+
+	x[0] = (char) a0;
+	x[1] = (char) a1;
+	memset(me, 0, ssize);
+	for (i = 0; i < n; i++)
+	{
+		if (EQUAL_RULE_ATTR(x, list[i].attr1))
+			me[(i << 1) >> 3] |= 1 << ((i << 1) & 7);
+		if (EQUAL_RULE_ATTR(x, list[i].attr2))
+			me[((i << 1) + 1) >> 3] |= 1 << (((i << 1) + 1) & 7);
+	}
+	for (c = 0; c < r->acls_num; c++)
+	{
+		if (!memcmp(sig + c * ssize, me, ssize))
+			return c;
+	}
+	if (c == RULE_ACLS_MAX)
+		return -1;
+	memcpy(sig + c * ssize, me, ssize);
+	rep[c][0] = x[0];
+	rep[c][1] = x[1];
+	r->acls_num++;
+	return c;
+}
+
+static void _rule_attr_compile(rule_t r)
+{
+	struct rule_bin_attr *list;
+	rule_attr_t a;
+	unsigned char *sig, seen[128], nrep[RULE_NCLS_MAX], np[2];
+	char rep[RULE_ACLS_MAX][2];
+	int i, j, k, n, c, ssize, a0, a1, c1, c2, n1, n2;
+	short *cell;
+
+	/* the rules as an array */
+	if (r->bin != NULL)
+	{
+		n = RULE_BIN(r)->nattr;
+		list = (struct rule_bin_attr *) RULE_BIN_PTR(r, off_attr);
+	}
+	else
+	{
+		for (a = r->attr, n = 0; a != NULL; a = a->next)
+			n++;
+		list = (struct rule_bin_attr *) xmalloc(sizeof(struct rule_bin_attr) * (n + 1));
+		for (a = r->attr, i = 0; a != NULL; a = a->next, i++)
+			memcpy(&list[i], a, sizeof(struct rule_bin_attr));
+	}
+	if (n == 0)
+		goto attr_end;
+
+	/* npath classes */
+	memset(r->ncls, 0, sizeof(r->ncls));
+	r->ncls_num = 1;
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0; j < 2; j++)
+		{
+			k = list[i].npath[j];
+			if (k == 0xff || r->ncls[k] != 0)
+				continue;
+			if (r->ncls_num == RULE_NCLS_MAX)
+				goto attr_end;
+			nrep[r->ncls_num] = (unsigned char) k;
+			r->ncls[k] = (unsigned char) r->ncls_num++;
+		}
+	}
+	for (k = 0; r->ncls[k] != 0; k++);
+	nrep[0] = (unsigned char) k;
+
+	/* attr classes, a1 is checked only if a rule names the 2nd char for a0 */
+	ssize = ((n << 1) + 7) >> 3;
+	sig = (unsigned char *) xmalloc((RULE_ACLS_MAX + 1) * ssize);
+	r->acls = (unsigned char *) xmalloc(128 * 128);
+	r->acls_num = 0;
+	for (a0 = 0; a0 < 128; a0++)
+	{
+		memset(seen, 0, sizeof(seen));
+		for (i = 0; i < n; i++)
+		{
+			if ((list[i].attr1[0] == '*' || list[i].attr1[0] == a0) && list[i].attr1[1] > 0)
+				seen[(int) list[i].attr1[1]] = 1;
+			if ((list[i].attr2[0] == '*' || list[i].attr2[0] == a0) && list[i].attr2[1] > 0)
+				seen[(int) list[i].attr2[1]] = 1;
+		}
+		if ((c = _rule_attr_class(r, list, n, sig, ssize, rep, a0, 0)) < 0)
+			break;
+		memset(r->acls + (a0 << 7), c, 128);
+		for (a1 = 1; a1 < 128; a1++)
+		{
+			if (!seen[a1])
+				continue;
+			if ((c = _rule_attr_class(r, list, n, sig, ssize, rep, a0, a1)) < 0)
+				break;
+			r->acls[(a0 << 7) | a1] = (unsigned char) c;
+		}
+		if (a1 < 128)
+			break;
+	}
+	xfree(sig);
+	if (a0 < 128)
+	{
+		xfree(r->acls);
+		r->acls = NULL;
+		goto attr_end;
+	}
+
+	/* the first matched rule of each class */
+	r->amat = (short *) xmalloc(sizeof(short) * r->acls_num * r->acls_num * r->ncls_num * r->ncls_num);
+	cell = r->amat;
+	for (c1 = 0; c1 < r->acls_num; c1++)
+	{
+		for (c2 = 0; c2 < r->acls_num; c2++)
+		{
+			for (n1 = 0; n1 < r->ncls_num; n1++)
+			{
+				for (n2 = 0; n2 < r->ncls_num; n2++, cell++)
+				{
+					np[0] = nrep[n1];
+					np[1] = nrep[n2];
+					*cell = 1;
+					for (i = 0; i < n; i++)
+					{
+						if (EQUAL_RULE_ATTR(rep[c1], list[i].attr1) && EQUAL_RULE_ATTR(rep[c2], list[i].attr2)
+							&& EQUAL_RULE_NPATH(np, list[i].npath))
+						{
+							*cell = list[i].ratio;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+attr_end:
+	if (r->bin == NULL)
+		xfree(list);
+}
+
 int scws_rule_attr_ratio(rule_t r, const char *attr1, const char *attr2, const unsigned char *npath)
 {
 	rule_attr_t a;
 	int ret = 1;
 
+	if (r != NULL && r->amat != NULL && !((attr1[0] | attr1[1] | attr2[0] | attr2[1]) & 0x80))
+	{
+		return (int) r->amat[((r->acls[RULE_ACODE(attr1)] * r->acls_num + r->acls[RULE_ACODE(attr2)])
+			* r->ncls_num + r->ncls[npath[0]]) * r->ncls_num + r->ncls[npath[1]]];
+	}
+
+	if (r != NULL && r->bin != NULL)
+	{
+		struct rule_bin_attr *b = (struct rule_bin_attr *) RULE_BIN_PTR(r, off_attr);
+		int i;
+
+		for (i = 0; i < RULE_BIN(r)->nattr; i++, b++)
+		{
+			if (EQUAL_RULE_ATTR(attr1, b->attr1) && EQUAL_RULE_ATTR(attr2, b->attr2) && EQUAL_RULE_NPATH(npath, b->npath))
+				return (int) b->ratio;
+		}
+		return ret;
+	}
+
 	if (!r || (a = r->attr) == NULL)
 		return ret;
 
@@ -55,6 +55,16 @@ typedef struct scws_rule
 	rule_attr_t attr;
 	struct scws_rule_item items[SCWS_RULE_MAX];
 	int ref;	// hightman.20130110: refcount (zero to really free/close)
+	void *bin;	// compiled image (tree & attr are NULL then), see scws_rule_compile
+	int bin_size;
+	int bin_type;	/* 1: mmap, 2: malloc */
+	/* attr ratio matrix: ascii attrs & npath values are interned to classes matching the same rules */
+	unsigned char *acls;	/* class of attr [a0][a1] (128x128) */
+	unsigned char ncls[256];	/* class of npath value */
+	int acls_num;
+	int ncls_num;
+	short *amat;	/* ratio of [acls1][acls2][ncls1][ncls2], NULL: walk the rules */
+	unsigned char *ztab;	/* item + 1 of the single-char words by charset_zindex(), NULL: none */
 }	rule_st, *rule_t;
 
 /* scws ruleset: api */
@@ -62,6 +72,10 @@ typedef struct scws_rule
 /* create & load ruleset, by fpath & charset */
 rule_t scws_rule_new(const char *fpath, unsigned char *mblen);
 
+/* compile the loaded ruleset into a binary image file (perfect hashed, mmap-able),
+ * scws_rule_new() maps it directly if fpath is such a file, return 0 on success */
+int scws_rule_compile(rule_t r, const char *fpath);
+
 /* fork ruleset */
 rule_t scws_rule_fork(rule_t r);
 
@@ -15,12 +15,21 @@
 #include "xdict.h"
 #include "rule.h"
 #include "charset.h"
-#include "darray.h"
-#include "xtree.h"
+#include "xthread.h"
+#include "xclass.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+
+#ifdef HAVE_MMAP
+#	include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#	define	O_BINARY	0
+#endif
 
 /* quick macro define for frequency usage */
 #define	SCWS_IS_SPECIAL(x,l)	scws_rule_checkbit(s->r,x,l,SCWS_RULE_SPECIAL)
@@ -30,6 +39,8 @@
 #define	SCWS_IS_ALPHA(x)		(((x)>=65&&(x)<=90)||((x)>=97&&(x)<=122))
 #define	SCWS_IS_UALPHA(x)		((x)>=65&&(x)<=90)
 #define	SCWS_IS_DIGIT(x)		((x)>=48&&(x)<=57)
+/* next byte or 0 at the end, a mapped file has no trailing '\0' */
+#define	SCWS_PEEK(i)			((i) < s->len ? s->txt[(i)] : 0)
 #define	SCWS_IS_WHEAD(x)		((x) & SCWS_ZFLAG_WHEAD)
 #define	SCWS_IS_ECHAR(x)		((x) & SCWS_ZFLAG_ENGLISH)
 #define	SCWS_NO_RULE1(x)		(((x) & (SCWS_ZFLAG_SYMBOL|SCWS_ZFLAG_ENGLISH))||(((x) & (SCWS_ZFLAG_WHEAD|SCWS_ZFLAG_NR2)) == SCWS_ZFLAG_WHEAD))
@@ -40,7 +51,86 @@
 #define	SCWS_CHAR_TOKEN(x)		((x)=='('||(x)==')'||(x)=='['||(x)==']'||(x)=='{'||(x)=='}'||(x)==':'||(x)=='"')	
 ///hightman.070814: max zlen = ?? (4 * zlen * zlen = ??)
 #define	SCWS_MAX_ZLEN			128
+///hightman.lattice: row bitmask of zmap[i].full/part, bit k => wmap[i][k]
+#define	SCWS_ZMASK_SET(m,k)		((m)[(k)>>6] |= (1ULL<<((k)&63)))
+#define	SCWS_ZMASK_CLR(m,k)		((m)[(k)>>6] &= ~(1ULL<<((k)&63)))
+#define	SCWS_ZMASK_ISSET(m,k)	((m)[(k)>>6] & (1ULL<<((k)&63)))
 #define	SCWS_EN_IDF(x)			(float)(2.5*logf((float)x))
+// window size of scws_send_text64, keep the int offsets inside safe
+#ifndef SCWS_WINDOW_MAX
+#define	SCWS_WINDOW_MAX			0x40000000
+#endif
+// tokens of a text longer than this are not all kept (get_tops & co. re-segment it)
+#ifndef SCWS_TOK_KEEP_MAX
+#define	SCWS_TOK_KEEP_MAX		0x1000000
+#endif
+
+/* charset variants of the chunk scanner */
+#define	SCWS_CS_TABLE			0
+#define	SCWS_CS_GBK				1
+#define	SCWS_CS_UTF8			2
+
+static int _scws_scan_gbk(scws_t s, int *zlen, int *pflag, int *rend);
+static int _scws_scan_utf8(scws_t s, int *zlen, int *pflag, int *rend);
+static int _scws_scan_table(scws_t s, int *zlen, int *pflag, int *rend);
+
+/* a segmented token of the current text, see _scws_token() */
+struct scws_token
+{
+	int off;
+	float idf;
+	unsigned int len;
+	char attr[3];
+	unsigned char view;
+	unsigned int id;
+};
+
+/* the tokens depend on the text, dict, rules & mode, drop them once any is changed */
+#define	SCWS_TOK_RESET(s)		do { (s)->tok_num = (s)->tok_base = (s)->tok_off = 0; } while (0)
+
+/* chunk result cache: direct mapped, a newer chunk replaces the older one of the slot */
+struct scws_cache_ent
+{
+	unsigned int hash;
+	unsigned int mode;
+	int budget;
+	int klen;			/* chunk bytes, saved after the tokens in data */
+	int ntok;
+	int degraded;
+	struct scws_token *data;
+};
+
+struct scws_cache
+{
+	int size;
+	unsigned long hits;
+	unsigned long misses;
+	struct scws_cache_ent *ents;
+};
+
+static void _scws_cache_flush(scws_t s);
+
+/* input transcoding: the text of another charset is converted to the utf-8 of the dict & rules,
+ * the offsets of the results are mapped back, see scws_set_input_charset */
+struct scws_xcode
+{
+	const unsigned short *tab;	/* see charset_conv_table */
+	unsigned char *mblen;		/* of the input charset */
+	const unsigned char *src;	/* the text of scws_send_text, NULL: not converted */
+	int len;
+	unsigned char *buf;			/* the converted text (s->txt) */
+	int *omap;					/* offset in src of each byte of buf, omap[s->len] = len */
+	int size;
+};
+
+/* the text over it can not be converted (the utf-8 one may be 3 times longer) */
+#define	SCWS_XC_MAX				0x20000000
+
+/* the text sent & the offset in it of txt[o] */
+#define	SCWS_XC_ON(s)			((s)->xc != NULL && (s)->xc->src != NULL)
+#define	SCWS_SRC(s)				(SCWS_XC_ON(s) ? (s)->xc->src : (s)->txt)
+#define	SCWS_SRC_LEN(s)			(SCWS_XC_ON(s) ? (s)->xc->len : (s)->len)
+#define	SCWS_SRC_OFF(s,o)		(SCWS_XC_ON(s) ? (s)->xc->omap[o] : (o))
 
 static const char *attr_en = "en";
 static const char *attr_un = "un";
@@ -51,11 +141,12 @@ static const char *attr_na = "!";
 scws_t scws_new()
 {
 	scws_t s;
-	s = (scws_t) malloc(sizeof(scws_st));
+	s = (scws_t) xmalloc(sizeof(scws_st));
     if (s == NULL)
         return s;
 	memset(s, 0, sizeof(scws_st));
 	s->mblen = charset_table_get(NULL);
+	s->scan = _scws_scan_gbk;
 	s->off = s->len = 0;
 	s->wend = -1;
 
@@ -70,18 +161,152 @@ scws_t scws_fork(scws_t p)
 	if (p != NULL && s != NULL)
 	{
 		s->mblen = p->mblen;
+		s->scan = p->scan;
 		s->mode = p->mode;
-		// fork dict/rules
-		s->r = scws_rule_fork(p->r);
-		s->d = xdict_fork(p->d);
+		s->budget = p->budget;
+		s->alloc = p->alloc;
+		if (p->xc != NULL)
+		{
+			if ((s->xc = (struct scws_xcode *) xmalloc_a(s->alloc, sizeof(struct scws_xcode))) == NULL)
+			{
+				scws_free(s);
+				return NULL;
+			}
+			memset(s->xc, 0, sizeof(struct scws_xcode));
+			s->xc->tab = p->xc->tab;
+			s->xc->mblen = p->xc->mblen;
+		}
+		if (p->e != NULL)
+		{
+			// one more context of the same engine
+			s->e = p->e;
+			xthread_atomic_add(&s->e->ref, 1);
+			s->r = p->r;
+			s->d = p->d;
+		}
+		else
+		{
+			// fork dict/rules
+			s->r = scws_rule_fork(p->r);
+			s->d = xdict_fork(p->d);
+		}
 	}
 
 	return s;
 }
 
+/* shared engine, the dict/rules are referred once by the engine,
+ * a context only takes a ref of the engine (one atomic add) */
+scws_engine_t scws_engine_new(scws_t s)
+{
+	scws_engine_t e;
+
+	if (s == NULL || (e = (scws_engine_t) xmalloc(sizeof(scws_engine_st))) == NULL)
+		return NULL;
+
+	e->d = xdict_fork(s->d);
+	e->r = scws_rule_fork(s->r);
+	e->mblen = s->mblen;
+	e->scan = s->scan;
+	e->mode = s->mode;
+	e->budget = s->budget;
+	e->alloc = s->alloc;
+	e->ref = 1;
+	return e;
+}
+
+scws_t scws_engine_ctx(scws_engine_t e)
+{
+	scws_t s;
+
+	if (e == NULL || (s = scws_new()) == NULL)
+		return NULL;
+
+	xthread_atomic_add(&e->ref, 1);
+	s->e = e;
+	s->d = e->d;
+	s->r = e->r;
+	s->mblen = e->mblen;
+	s->scan = e->scan;
+	s->mode = e->mode;
+	s->budget = e->budget;
+	s->alloc = e->alloc;
+	return s;
+}
+
+void scws_engine_free(scws_engine_t e)
+{
+	if (e != NULL && xthread_atomic_add(&e->ref, -1) == 0)
+	{
+		if (e->d)
+			xdict_close(e->d);
+		if (e->r)
+			scws_rule_free(e->r);
+		xfree(e);
+	}
+}
+
+/* a context is going to change its dict/rules, take its own refs & leave the engine */
+static void _scws_detach(scws_t s)
+{
+	if (s->e != NULL)
+	{
+		s->d = xdict_fork(s->d);
+		s->r = scws_rule_fork(s->r);
+		scws_engine_free(s->e);
+		s->e = NULL;
+	}
+}
+
+/* release the text of scws_send_file/fd */
+static void _scws_send_release(scws_t s)
+{
+	if (s->fmap != NULL)
+	{
+#ifdef HAVE_MMAP
+		if (s->fmap_type == 1)
+			munmap(s->fmap, s->fmap_len);
+		else
+#endif
+			xfree_a(s->alloc, s->fmap);
+		s->fmap = NULL;
+		s->fmap_len = 0;
+		s->fmap_type = 0;
+	}
+	if (s->xc != NULL)
+		s->xc->src = NULL;
+}
+
+static void _scws_xc_free(scws_t s)
+{
+	if (s->xc != NULL)
+	{
+		if (s->xc->buf != NULL)
+			xfree_a(s->alloc, s->xc->buf);
+		if (s->xc->omap != NULL)
+			xfree_a(s->alloc, s->xc->omap);
+		xfree_a(s->alloc, s->xc);
+		s->xc = NULL;
+	}
+}
+
 /* close & free the engine */
 void scws_free(scws_t s)
 {
+	_scws_send_release(s);
+	if (s->tok)
+		xfree_a(s->alloc, s->tok);
+	if (s->pool)
+		pool_free(s->pool);
+	if (s->cache)
+		scws_set_cache(s, 0);
+	_scws_xc_free(s);
+	if (s->e)
+	{
+		scws_engine_free(s->e);
+		s->d = NULL;
+		s->r = NULL;
+	}
 	if (s->d)
 	{
 		xdict_close(s->d);
@@ -92,13 +317,15 @@ void scws_free(scws_t s)
 		scws_rule_free(s->r);
 		s->r = NULL;
 	}
-	free(s);
+	xfree(s);
 }
 
 /* add a dict into scws */
 int scws_add_dict(scws_t s, const char *fpath, int mode)
 {
 	xdict_t xx;
+
+	_scws_detach(s);
 	if (mode & SCWS_XDICT_SET)
 	{
 		xdict_close(s->d);
@@ -107,6 +334,8 @@ int scws_add_dict(scws_t s, const char *fpath, int mode)
 	}
 	xx = s->d;
 	s->d = xdict_add(s->d, fpath, mode, s->mblen);
+	SCWS_TOK_RESET(s);
+	_scws_cache_flush(s);
 	return (xx == s->d ? -1 : 0);
 }
 
@@ -119,19 +348,54 @@ int scws_set_dict(scws_t s, const char *fpath, int mode)
 void scws_set_charset(scws_t s, const char *cs)
 {
 	s->mblen = charset_table_get(cs);
+	if (s->mblen == charset_table_get("gbk"))
+		s->scan = _scws_scan_gbk;
+	else if (s->mblen == charset_table_get("utf8"))
+		s->scan = _scws_scan_utf8;
+	else
+		s->scan = _scws_scan_table;
+	_scws_xc_free(s);
+	SCWS_TOK_RESET(s);
+	_scws_cache_flush(s);
+}
+
+int scws_set_input_charset(scws_t s, const char *cs)
+{
+	const unsigned short *tab;
+
+	_scws_xc_free(s);
+	SCWS_TOK_RESET(s);
+	if (cs == NULL)
+		return 0;
+	if (s->mblen != charset_table_get("utf8"))
+		return -1;
+	if (charset_table_get(cs) == s->mblen)
+		return 0;
+	if ((tab = charset_conv_table(cs)) == NULL)
+		return -1;
+
+	s->xc = (struct scws_xcode *) xmalloc_a(s->alloc, sizeof(struct scws_xcode));
+	memset(s->xc, 0, sizeof(struct scws_xcode));
+	s->xc->tab = tab;
+	s->xc->mblen = charset_table_get(cs);
+	return 0;
 }
 
 void scws_set_rule(scws_t s, const char *fpath)
 {
+	_scws_detach(s);
 	if (s->r != NULL)
 		scws_rule_free(s->r);
 
 	s->r = scws_rule_new(fpath, s->mblen);	
+	SCWS_TOK_RESET(s);
+	_scws_cache_flush(s);
 }
 
 /* set ignore symbol or multi segments */
 void scws_set_ignore(scws_t s, int yes)
 {
+	SCWS_TOK_RESET(s);
 	if (yes == SCWS_YEA)
 		s->mode |= SCWS_IGN_SYMBOL;
 
@@ -141,6 +405,7 @@ void scws_set_ignore(scws_t s, int yes)
 
 void scws_set_multi(scws_t s, int mode)
 {
+	SCWS_TOK_RESET(s);
 	s->mode &= ~SCWS_MULTI_MASK;
 
 	if (mode & SCWS_MULTI_MASK)	
@@ -158,6 +423,7 @@ void scws_set_debug(scws_t s, int yes)
 
 void scws_set_duality(scws_t s, int yes)
 {
+	SCWS_TOK_RESET(s);
 	if (yes == SCWS_YEA)
 		s->mode |= SCWS_DUALITY;
 
@@ -165,24 +431,328 @@ void scws_set_duality(scws_t s, int yes)
 		s->mode &= ~SCWS_DUALITY;
 }
 
+void scws_set_greedy(scws_t s, int mode)
+{
+	SCWS_TOK_RESET(s);
+	s->mode &= ~SCWS_GREEDY_MASK;
+
+	if (mode & SCWS_GREEDY_MASK)
+		s->mode |= (mode & SCWS_GREEDY_BACKWARD ? SCWS_GREEDY_BACKWARD : SCWS_GREEDY_FORWARD);
+}
+
+void scws_set_budget(scws_t s, int units)
+{
+	SCWS_TOK_RESET(s);
+	s->budget = (units > 0 ? units : 0);
+}
+
+/* allocator of the context memory & the results, see scws.h */
+void scws_set_allocator(scws_t s, const xalloc_st *a)
+{
+	int size;
+
+	if (s == NULL)
+	{
+		xalloc_set(a);
+		return;
+	}
+
+	/* the buffers of the old one, a mapped text is gone too */
+	if (s->fmap != NULL)
+	{
+		_scws_send_release(s);
+		s->txt = NULL;
+		s->len = s->off = 0;
+		s->xbase = s->xlen = 0;
+	}
+	if (s->pool != NULL)
+	{
+		pool_free(s->pool);
+		s->pool = NULL;
+	}
+	if (s->tok != NULL)
+	{
+		xfree_a(s->alloc, s->tok);
+		s->tok = NULL;
+		s->tok_size = 0;
+		SCWS_TOK_RESET(s);
+	}
+	size = (s->cache ? s->cache->size : 0);
+	scws_set_cache(s, 0);
+	s->alloc = a;
+	scws_set_cache(s, size);
+}
+
+int scws_get_degraded(scws_t s)
+{
+	return s->degraded;
+}
+
+void scws_set_cache(scws_t s, int size)
+{
+	struct scws_cache *c;
+	int i;
+
+	if ((c = s->cache) != NULL)
+	{
+		for (i = 0; i < c->size; i++)
+		{
+			if (c->ents[i].data != NULL)
+				xfree_a(s->alloc, c->ents[i].data);
+		}
+		xfree_a(s->alloc, c->ents);
+		xfree_a(s->alloc, c);
+		s->cache = NULL;
+	}
+
+	if (size > 0)
+	{
+		c = (struct scws_cache *) xmalloc_a(s->alloc, sizeof(struct scws_cache));
+		for (c->size = 1; c->size < size; c->size <<= 1);
+		c->hits = c->misses = 0;
+		c->ents = (struct scws_cache_ent *) xmalloc_a(s->alloc, c->size * sizeof(struct scws_cache_ent));
+		memset(c->ents, 0, c->size * sizeof(struct scws_cache_ent));
+		s->cache = c;
+	}
+}
+
+void scws_get_cache_stats(scws_t s, unsigned long *hits, unsigned long *misses)
+{
+	if (hits != NULL)
+		*hits = (s->cache ? s->cache->hits : 0);
+	if (misses != NULL)
+		*misses = (s->cache ? s->cache->misses : 0);
+}
+
+/* the dict, rules or charset changed (the mode is a part of the key) */
+static void _scws_cache_flush(scws_t s)
+{
+	int i;
+
+	if (s->cache == NULL)
+		return;
+
+	for (i = 0; i < s->cache->size; i++)
+	{
+		if (s->cache->ents[i].data != NULL)
+		{
+			xfree_a(s->alloc, s->cache->ents[i].data);
+			s->cache->ents[i].data = NULL;
+		}
+	}
+}
+
+/* convert the text to xc->buf (the buffers only grow), return the length of it,
+ * or -1 if it is too long or out of memory */
+static int _scws_xc_conv(scws_t s, const char *text, int len)
+{
+	struct scws_xcode *xc = s->xc;
+	int n;
+
+	if (len < 0 || len > SCWS_XC_MAX)
+		return -1;
+	n = charset_conv_utf8(xc->tab, xc->mblen, (const unsigned char *) text, len, NULL, NULL);
+	if (n >= xc->size)
+	{
+		if (xc->buf != NULL)
+			xfree_a(s->alloc, xc->buf);
+		if (xc->omap != NULL)
+			xfree_a(s->alloc, xc->omap);
+		xc->size = n + 1;
+		xc->buf = (unsigned char *) xmalloc_a(s->alloc, xc->size);
+		xc->omap = (int *) xmalloc_a(s->alloc, sizeof(int) * xc->size);
+		if (xc->buf == NULL || xc->omap == NULL)
+		{
+			if (xc->buf != NULL)
+				xfree_a(s->alloc, xc->buf);
+			if (xc->omap != NULL)
+				xfree_a(s->alloc, xc->omap);
+			xc->buf = NULL;
+			xc->omap = NULL;
+			xc->size = 0;
+			return -1;
+		}
+	}
+	charset_conv_utf8(xc->tab, xc->mblen, (const unsigned char *) text, len, xc->buf, xc->omap);
+	xc->src = (const unsigned char *) text;
+	xc->len = len;
+	return n;
+}
+
 /* send the text buffer & init some others */
 void scws_send_text(scws_t s, const char *text, int len)
 {
+	_scws_send_release(s);
+	if (s->xc != NULL)
+	{
+		// convert to utf-8, the text can not be converted is not sent
+		if ((len = _scws_xc_conv(s, text, len)) < 0)
+		{
+			text = "";
+			len = 0;
+		}
+		else
+			text = (const char *) s->xc->buf;
+	}
 	s->txt = (unsigned char *) text;
 	s->len = len;
 	s->off = 0;
+	s->xbase = 0;
+	s->xlen = (size_t) len;
+	s->degraded = 0;
+	SCWS_TOK_RESET(s);
+}
+
+/* end of the next window (at most SCWS_WINDOW_MAX bytes), cut after a whitespace if possible */
+static int _scws_window(scws_t s, size_t rest)
+{
+	unsigned char *txt = s->txt;
+	int off, cut, last;
+
+	if (rest <= SCWS_WINDOW_MAX)
+		return (int) rest;
+
+	for (off = cut = last = 0; off < SCWS_WINDOW_MAX; off += SCWS_CHARLEN(txt[off]))
+	{
+		last = off;
+		if (txt[off] <= 0x20)
+			cut = off + 1;
+	}
+	return (cut > 0 ? cut : last);
+}
+
+void scws_send_text64(scws_t s, const char *text, size_t len)
+{
+	// the converted text must fit in int
+	if (s->xc != NULL)
+	{
+		scws_send_text(s, text, len > SCWS_XC_MAX ? -1 : (int) len);
+		return;
+	}
+	_scws_send_release(s);
+	s->txt = (unsigned char *) text;
+	s->off = 0;
+	s->xbase = 0;
+	s->xlen = len;
+	s->len = _scws_window(s, len);
+	s->degraded = 0;
+	SCWS_TOK_RESET(s);
+}
+
+/* segment a file without reading it into a buffer, the mapped pages
+ * are read ahead sequentially & dropped by the kernel as needed, pipes etc. are read */
+int scws_send_fd(scws_t s, int fd)
+{
+	struct stat st;
+	unsigned char *map;
+	size_t len, size;
+	int n, type;
+
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return -1;
+	if (s->xc != NULL && S_ISREG(st.st_mode) && st.st_size > SCWS_XC_MAX)
+		return -1;
+
+	map = NULL;
+	len = 0;
+	type = 0;
+#ifdef HAVE_MMAP
+	if (S_ISREG(st.st_mode) && st.st_size > 0 && (off_t) (size_t) st.st_size == st.st_size)
+	{
+		len = (size_t) st.st_size;
+		map = (unsigned char *) mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == (unsigned char *) MAP_FAILED)
+			map = NULL;
+		else
+		{
+#ifdef MADV_SEQUENTIAL
+			madvise(map, len, MADV_SEQUENTIAL);
+#endif
+			type = 1;
+		}
+	}
+#endif
+
+	if (map == NULL)
+	{
+		size = (S_ISREG(st.st_mode) && st.st_size > 0) ? (size_t) st.st_size + 1 : 0x10000;
+		if ((map = (unsigned char *) xmalloc_a(s->alloc, size)) == NULL)
+			return -1;
+		len = 0;
+		while ((n = read(fd, map + len, (size - len) > 0x40000000 ? 0x40000000 : (size - len))) > 0)
+		{
+			len += n;
+			if (len == size)
+			{
+				unsigned char *tmp;
+
+				if ((tmp = (unsigned char *) xrealloc_a(s->alloc, map, size << 1)) == NULL)
+				{
+					n = -1;
+					break;
+				}
+				map = tmp;
+				size <<= 1;
+			}
+		}
+		if (n < 0)
+		{
+			xfree_a(s->alloc, map);
+			return -1;
+		}
+		map[len] = '\0';
+		type = 2;
+	}
+
+	scws_send_text64(s, (const char *) map, len);
+	s->fmap = map;
+	s->fmap_len = len;
+	s->fmap_type = type;
+
+	// not sent, it can not be converted
+	if (s->xc != NULL && s->xc->src == NULL)
+	{
+		_scws_send_release(s);
+		return -1;
+	}
+	return 0;
+}
+
+int scws_send_file(scws_t s, const char *fpath)
+{
+	int fd, ret;
+
+	if ((fd = open(fpath, O_RDONLY | O_BINARY)) < 0)
+		return -1;
+	ret = scws_send_fd(s, fd);
+	close(fd);
+	return ret;
 }
 
-/* get some words, if these is not words, return NULL */
-#define	SCWS_PUT_RES(o,i,l,a)									\
+/* get some words, if these is not words, return NULL.
+ * the node keeps the full length (res->len is only 8 bits) for scws_get_result64,
+ * the view it belongs to (scws_result has no room left for it) & the allocator after
+ * the public part, so a node of the default allocator can still be passed to free() */
+struct scws_result_ex
+{
+	struct scws_result r;
+	unsigned int len;
+	unsigned char view;
+	const xalloc_st *alloc;
+};
+
+#define	SCWS_PUT_RES(o,i,l,a,d)									\
 do {															\
 	scws_res_t res;												\
-	res = (scws_res_t) malloc(sizeof(struct scws_result));		\
+	res = (scws_res_t) xmalloc_a(s->alloc, sizeof(struct scws_result_ex));	\
+	((struct scws_result_ex *) res)->alloc = s->alloc;			\
 	res->off = o;												\
 	res->idf = i;												\
-	res->len = l;												\
+	res->len = ((struct scws_result_ex *) res)->len = l;		\
+	((struct scws_result_ex *) res)->view = s->view;			\
 	strncpy(res->attr, a, 2);									\
 	res->attr[2] = '\0';										\
+	res->id = (d) ? (d) : scws_hash_id((const char *) s->txt + (o), l);	\
 	res->next = NULL;											\
 	if (s->res1 == NULL)										\
 		s->res1 = s->res0 = res;								\
@@ -203,16 +773,6 @@ do {															\
 #define	PFLAG_LONGDIGIT		0x40
 #define	PFLAG_LONGALPHA		0x80
 
-static void _str_toupper(char *src, char *dst)
-{
-	while (*src)
-	{
-		*dst++ = *src++;
-		if (dst[-1] >= 'a' && dst[-1] <= 'z')
-			dst[-1] ^= 0x20;
-	}
-}
-
 static void _str_tolower(char *src, char *dst)
 {
 	while (*src)
@@ -223,19 +783,6 @@ static void _str_tolower(char *src, char *dst)
 	}
 }
 
-#ifdef HAVE_STRNDUP
-#define	_mem_ndup		strndup
-#else
-static inline void *_mem_ndup(const char *src, int len)
-{
-	char *dst;
-	dst = malloc(len+1);
-	memcpy(dst, src, len);
-	dst[len] = '\0';
-	return dst;
-}
-#endif
-
 static void _scws_alnum_multi(scws_t s, int start, int wlen)
 {
 	char chunk[SCWS_MAX_EWLEN];
@@ -300,12 +847,12 @@ static void _scws_alnum_multi(scws_t s, int start, int wlen)
 					if (!SCWS_IS_ALNUM(txt[ch-1]))
 					{
 						idf = SCWS_EN_IDF(chunk[i]);
-						SCWS_PUT_RES(ch, idf, chunk[i], attr_en);
+						SCWS_PUT_RES(ch, idf, chunk[i], attr_en, 0);
 					}
 					else
 					{
 						idf = SCWS_EN_IDF(chunk[i-1]+1);
-						SCWS_PUT_RES(ch - chunk[i-1], idf, chunk[i-1]+1, attr_en);
+						SCWS_PUT_RES(ch - chunk[i-1], idf, chunk[i-1]+1, attr_en, 0);
 					}
 				}
 				if (i < j && (i != 0 || j != 1))
@@ -313,19 +860,19 @@ static void _scws_alnum_multi(scws_t s, int start, int wlen)
 					if (!SCWS_IS_ALNUM(txt[ch+1]))
 					{
 						idf = SCWS_EN_IDF(chunk[i]);
-						SCWS_PUT_RES(ch, idf, chunk[i], attr_en);
+						SCWS_PUT_RES(ch, idf, chunk[i], attr_en, 0);
 					}
 					else
 					{
 						idf = SCWS_EN_IDF(chunk[i+1]+1);
-						SCWS_PUT_RES(ch, idf, chunk[i+1]+1, attr_en);
+						SCWS_PUT_RES(ch, idf, chunk[i+1]+1, attr_en, 0);
 					}
 				}
 			}
 			else
 			{
 				idf = SCWS_EN_IDF(chunk[i]);
-				SCWS_PUT_RES(ch, idf, chunk[i], attr_en);
+				SCWS_PUT_RES(ch, idf, chunk[i], attr_en, 0);
 			}
 			ch += chunk[i];
 		}
@@ -343,21 +890,25 @@ static void _scws_ssegment(scws_t s, int end)
 
 	/* check special words (need strtoupper) */
 	if (wlen > 1)
-	{	
-		txt = (char *) _mem_ndup(s->txt + start, wlen);	
-		_str_toupper(txt, txt);
-		if (SCWS_IS_SPECIAL(txt, wlen))
+	{
+		unsigned char upper[SCWS_MAX_ZLEN];
+
+		txt = (wlen < SCWS_MAX_ZLEN ? upper : (unsigned char *) xmalloc_a(s->alloc, wlen + 1));
+		xclass_toupper(txt, s->txt + start, wlen);
+		txt[wlen] = '\0';
+		ch = SCWS_IS_SPECIAL(txt, wlen);
+		if (txt != upper)
+			xfree_a(s->alloc, txt);
+		if (ch)
 		{
-			SCWS_PUT_RES(start, 9.5, wlen, "nz");
-			free(txt);
+			SCWS_PUT_RES(start, 9.5, wlen, "nz", 0);
 			return;
 		}
-		free(txt);
 	}
 
 	txt = s->txt;	
 	/* check brief words such as S.H.E M.R. */	
-	if (SCWS_IS_ALPHA(txt[start]) && txt[start+1] == '.')
+	if (SCWS_IS_ALPHA(txt[start]) && SCWS_PEEK(start+1) == '.')
 	{
 		for (ch = start + 2; ch < end; ch++)
 		{
@@ -367,7 +918,7 @@ static void _scws_ssegment(scws_t s, int end)
 		}
 		if (ch == end)
 		{
-			SCWS_PUT_RES(start, 7.5, wlen, "nz");
+			SCWS_PUT_RES(start, 7.5, wlen, "nz", 0);
 			return;
 		}
 	}
@@ -390,7 +941,7 @@ static void _scws_ssegment(scws_t s, int end)
 					if (!SCWS_IS_DIGIT(ch))
 					{
 						// check percent % = 0x25
-						if (ch == 0x25 && !SCWS_IS_DIGIT(txt[start+1]))
+						if (ch == 0x25 && !SCWS_IS_DIGIT(SCWS_PEEK(start+1)))
 						{
 							start++;
 							wlen++;
@@ -414,7 +965,7 @@ static void _scws_ssegment(scws_t s, int end)
 							continue;
 						}
 						// strict must add: !$this->_is_digit(ord($this->txt[$start+1])))
-						if ((pflag & PFLAG_ADDSYM) || !(ch == 0x2e && SCWS_IS_DIGIT(txt[start+1])))
+						if ((pflag & PFLAG_ADDSYM) || !(ch == 0x2e && SCWS_IS_DIGIT(SCWS_PEEK(start+1))))
 							break;
 						pflag |= PFLAG_ADDSYM;
 					}
@@ -422,13 +973,13 @@ static void _scws_ssegment(scws_t s, int end)
 				else
 				{
 					/* hightman.110419: - 出现在字母中间允许连接(0x2d), _ 允许连接(0x5f) */
-					if ((ch == 0x2d || ch == 0x5f) && SCWS_IS_ALPHA(txt[start+1]))
+					if ((ch == 0x2d || ch == 0x5f) && SCWS_IS_ALPHA(SCWS_PEEK(start+1)))
 						pflag |= PFLAG_ADDSYM;
 					else if (!SCWS_IS_ALPHA(ch))
 					{
 						if ((pflag & PFLAG_ADDSYM)
-							|| !((ch == 0x27 && SCWS_IS_ALPHA(txt[start+1]))
-								|| (SCWS_IS_DIGIT(ch) && !SCWS_IS_DIGIT(txt[start+1]))))
+							|| !((ch == 0x27 && SCWS_IS_ALPHA(SCWS_PEEK(start+1)))
+								|| (SCWS_IS_DIGIT(ch) && !SCWS_IS_DIGIT(SCWS_PEEK(start+1)))))
 						{
 							break;
 						}
@@ -441,41 +992,99 @@ static void _scws_ssegment(scws_t s, int end)
 					break;
 			}
 			idf = SCWS_EN_IDF(wlen);
-			SCWS_PUT_RES(start-wlen, idf, wlen, attr_en);
+			SCWS_PUT_RES(start-wlen, idf, wlen, attr_en, 0);
 			if ((s->mode & SCWS_MULTI_DUALITY) && (pflag & PFLAG_ADDSYM))
+			{
+				s->view = SCWS_VIEW_DUALITY;
 				_scws_alnum_multi(s, start-wlen, wlen);
+				s->view = SCWS_VIEW_BASE;
+			}
 		}
 		else if (!(s->mode & SCWS_IGN_SYMBOL))
 		{
-			SCWS_PUT_RES(start-1, 0.0, 1, attr_un);
+			SCWS_PUT_RES(start-1, 0.0, 1, attr_un, 0);
 		}
 	}
 }
 
+/* lowest set bit of the row mask in [f, t], -1 if none */
+static inline int _zmask_first(const unsigned long long *m, int f, int t)
+{
+	unsigned long long v;
+	int w;
+
+	for (w = (f >> 6); f <= t; w++, f = (w << 6))
+	{
+		v = m[w] & (~0ULL << (f & 63));
+		if ((t >> 6) == w && (t & 63) != 63)
+			v &= ((1ULL << ((t & 63) + 1)) - 1);
+		if (v != 0)
+			return (w << 6) + _bit_ctzll(v);
+	}
+	return -1;
+}
+
+/* highest set bit of the row mask in [f, t], -1 if none */
+static inline int _zmask_last(const unsigned long long *m, int f, int t)
+{
+	unsigned long long v;
+	int w;
+
+	for (w = (t >> 6); f <= t; w--, t = w * 64 + 63)
+	{
+		v = m[w];
+		if ((t & 63) != 63)
+			v &= ((1ULL << ((t & 63) + 1)) - 1);
+		if ((f >> 6) == w)
+			v &= (~0ULL << (f & 63));
+		if (v != 0)
+			return (w << 6) + 63 - _bit_clzll(v);
+	}
+	return -1;
+}
+
 /* multibyte segment */
 static int _scws_mget_word(scws_t s, int i, int j)
 {
-	int r, k;
-	word_t item;
+	unsigned long long stop[SCWS_ZMASK_WORDS];
+	struct scws_zchar *z;
+	int r;
 
-	if (!(s->wmap[i][i]->flag & SCWS_ZFLAG_WHEAD))
+	if (!(s->wmap[i][i]->flag & SCWS_ZFLAG_WHEAD) || j <= i)
 		return i;
 
-	for (r=i, k=i+1; k <= j; k++)
+	/* the first full word which can't grow longer, otherwise the longest one */
+	z = &s->zmap[i];
+	for (r = 0; r < SCWS_ZMASK_WORDS; r++)
+		stop[r] = z->full[r] & ~z->part[r];
+
+	if ((r = _zmask_first(stop, i+1, j)) < 0 && (r = _zmask_last(z->full, i+1, j)) < 0)
+		r = i;
+	return r;
+}
+
+/* id of the bigram of char m & m+1: of the dict entry (queried, the lattice row of m may not
+ * be built), or 0 to hash it */
+static unsigned int _scws_dual_id(scws_t s, int m)
+{
+	word_t query;
+	unsigned int id = 0;
+
+	query = xdict_query(s->d, (const char *) s->txt + s->zmap[m].start, s->zmap[m+1].end - s->zmap[m].start);
+	if (query != NULL)
 	{
-		item = s->wmap[i][k];
-		if (item && (item->flag & SCWS_WORD_FULL))
-		{
-			r = k;
-			if (!(item->flag & SCWS_WORD_PART))
-				break;					
-		}
+		if ((query->flag & SCWS_WORD_FULL) && memcmp(query->attr, attr_na, 2))
+			id = query->id;
+		if (query->flag & SCWS_WORD_MALLOCED)
+			xfree(query);
 	}
-	return r;
+	return id;
 }
 
 static void _scws_mset_word(scws_t s, int i, int j)
 {
+	unsigned long long stop[SCWS_ZMASK_WORDS];
+	unsigned int id;
 	word_t item;
 
 	item = s->wmap[i][j];
@@ -483,6 +1092,7 @@ static void _scws_mset_word(scws_t s, int i, int j)
 	if ((item == NULL) || ((s->mode & SCWS_IGN_SYMBOL) 
       && !SCWS_IS_ECHAR(item->flag) && !memcmp(item->attr, attr_un, 2)))
 		return;
+	id = item->id;
 
 	/* hightman.070701: 散字自动二元聚合 */
 	if (s->mode & SCWS_DUALITY)
@@ -498,18 +1108,19 @@ static void _scws_mset_word(scws_t s, int i, int j)
 			i = (k & ~SCWS_ZIS_USED);
 			if ((i != (j-1)) || (!(k & SCWS_ZIS_USED) && s->wend == i))
 			{
-				SCWS_PUT_RES(s->zmap[i].start, s->wmap[i][i]->idf, (s->zmap[i].end - s->zmap[i].start), s->wmap[i][i]->attr);
+				SCWS_PUT_RES(s->zmap[i].start, s->wmap[i][i]->idf, (s->zmap[i].end - s->zmap[i].start), s->wmap[i][i]->attr, s->wmap[i][i]->id);
 				if (i != (j-1))
 					return;
 			}
 			s->zis |= SCWS_ZIS_USED;
+			id = _scws_dual_id(s, i);
 		}
 		else
 		{
 			if ((k >= 0) && (!(k & SCWS_ZIS_USED) || (j > i)))
 			{
 				k &= ~SCWS_ZIS_USED;
-				SCWS_PUT_RES(s->zmap[k].start, s->wmap[k][k]->idf, (s->zmap[k].end - s->zmap[k].start), s->wmap[k][k]->attr);
+				SCWS_PUT_RES(s->zmap[k].start, s->wmap[k][k]->idf, (s->zmap[k].end - s->zmap[k].start), s->wmap[k][k]->attr, s->wmap[k][k]->id);
 			}
 			if (j > i)
 				s->wend = j + 1;
@@ -517,29 +1128,39 @@ static void _scws_mset_word(scws_t s, int i, int j)
 		}
 	}
 		
-	SCWS_PUT_RES(s->zmap[i].start, item->idf, (s->zmap[j].end - s->zmap[i].start), item->attr);
+	SCWS_PUT_RES(s->zmap[i].start, item->idf, (s->zmap[j].end - s->zmap[i].start), item->attr, id);
 
 	// hightman.070902: multi segment
 	// step1: split to short words
+	// the words below are the expansions, tagged by the view (see scws_res_view)
 	if ((j-i) > 1)
 	{
 		int n, k, m = i;
 		if (s->mode & SCWS_MULTI_SHORT)
 		{
+			s->view = SCWS_VIEW_SHORT;
 			while (m < j)
 			{
 				k = m;
 				// hightman.111223: multi short enhanced
-				for (n = m + 1; n <= j; n++)
+				// 3 chars at most, stop at the first word which can't grow longer
+				n = ((m + 2) < j ? (m + 2) : j);
+				if (n == j && m == i)
+					n--;
+				if (n > m)
 				{
-					// 3 chars at most
-					if ((n == j && m == i) || (n - m) > 2) break;
-					item = s->wmap[m][n];	
-					if (!item) continue;
+					struct scws_zchar *z = &s->zmap[m];
+					int e;
+
+					for (e = 0; e < SCWS_ZMASK_WORDS; e++)
+						stop[e] = z->full[e] & ~z->part[e];
+					if ((e = _zmask_first(stop, m+1, n)) >= 0)
+						n = e;
 					// first shortest or last longest word
-					if ((item->flag & SCWS_WORD_FULL) && (k == m || n == j))
-						k = n;
-					if (!(item->flag & SCWS_WORD_PART)) break;
+					if (n == j && SCWS_ZMASK_ISSET(z->full, j))
+						k = j;
+					else if ((e = _zmask_first(z->full, m+1, n)) >= 0)
+						k = e;
 				}
 				// short word not found, stop to find, passed to next loop
 				if (k == m)
@@ -547,7 +1168,7 @@ static void _scws_mset_word(scws_t s, int i, int j)
 				
 				// save the short word
 				item = s->wmap[m][k];
-				SCWS_PUT_RES(s->zmap[m].start, item->idf, (s->zmap[k].end - s->zmap[m].start), item->attr);
+				SCWS_PUT_RES(s->zmap[m].start, item->idf, (s->zmap[k].end - s->zmap[m].start), item->attr, item->id);
 				// find the next word or go to prev for duality last word
 				if ((m = k + 1) == j)
 				{
@@ -559,32 +1180,33 @@ static void _scws_mset_word(scws_t s, int i, int j)
 
 		if (s->mode & SCWS_MULTI_DUALITY)
 		{
+			s->view = SCWS_VIEW_DUALITY;
 			while (m < j)
 			{
 				if (SCWS_IS_ECHAR(s->wmap[m][m]->flag))
 				{
-					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr);
+					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr, s->wmap[m][m]->id);
 					s->wmap[m][m]->flag |= SCWS_ZFLAG_PUT;
 				}
 				else if (SCWS_IS_ECHAR(s->wmap[m+1][m+1]->flag))
 				{
 					if (m == i)
 					{
-						SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr);
+						SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr, s->wmap[m][m]->id);
 						s->wmap[m][m]->flag |= SCWS_ZFLAG_PUT;
 					}
 					m++;
-					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr);
+					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr, s->wmap[m][m]->id);
 					s->wmap[m][m]->flag |= SCWS_ZFLAG_PUT;
 				}
 				else
 				{
-					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m+1].end - s->zmap[m].start), s->wmap[m][m]->attr);
+					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m+1].end - s->zmap[m].start), s->wmap[m][m]->attr, _scws_dual_id(s, m));
 				}
 				m++;
 				if (m == j && (SCWS_IS_ECHAR(s->wmap[m][m]->flag) || SCWS_IS_ECHAR(s->wmap[m-1][m-1]->flag)))
 				{
-					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr);
+					SCWS_PUT_RES(s->zmap[m].start, s->wmap[m][m]->idf, (s->zmap[m].end - s->zmap[m].start), s->wmap[m][m]->attr, s->wmap[m][m]->id);
 					s->wmap[m][m]->flag |= SCWS_ZFLAG_PUT;
 				}
 			}
@@ -594,6 +1216,7 @@ static void _scws_mset_word(scws_t s, int i, int j)
 	// step2, split to single char
 	if ((j > i) && (s->mode & (SCWS_MULTI_ZMAIN|SCWS_MULTI_ZALL)))
 	{
+		s->view = (s->mode & SCWS_MULTI_ZALL) ? SCWS_VIEW_ZALL : SCWS_VIEW_ZMAIN;
 		if ((j - i) == 1 && !s->wmap[i][j])
 		{
 			if (s->wmap[i][i]->flag & SCWS_ZFLAG_PUT) i++;
@@ -606,12 +1229,17 @@ static void _scws_mset_word(scws_t s, int i, int j)
 				continue;
 			if (!(s->mode & SCWS_MULTI_ZALL) && !strchr("jnv", s->wmap[i][i]->attr[0]))
 				continue;
-			SCWS_PUT_RES(s->zmap[i].start, s->wmap[i][i]->idf, (s->zmap[i].end - s->zmap[i].start), s->wmap[i][i]->attr);
+			SCWS_PUT_RES(s->zmap[i].start, s->wmap[i][i]->idf, (s->zmap[i].end - s->zmap[i].start), s->wmap[i][i]->attr, s->wmap[i][i]->id);
 		}
 		while (++i <= j);
 	}
+	s->view = SCWS_VIEW_BASE;
 }
 
+static void _scws_mseg_greedy(scws_t s, pool_t p, int f, int t);
+
+/* score the paths of the zone, one work unit per lattice step. over the budget of
+ * the chunk, the rest zones fall back to greedy matching (see scws_set_budget) */
 static void _scws_mseg_zone(scws_t s, int f, int t)
 {
 	unsigned char *mpath, *npath;
@@ -623,6 +1251,13 @@ static void _scws_mseg_zone(scws_t s, int f, int t)
 	mpath = npath = NULL;
 	weight = nweight = (double) 0.0;
 
+	/* the chunk ran out of budget already */
+	if (s->work < 0)
+	{
+		_scws_mseg_greedy(s, NULL, f, t);
+		return;
+	}
+
 	wmap = s->wmap;
 	j2 = 0;
 	for (x = i = f; i <= t; i++)
@@ -636,7 +1271,7 @@ static void _scws_mseg_zone(scws_t s, int f, int t)
 		/* one word only */
 		if (i == f && j == t)
 		{
-			mpath = (unsigned char *) malloc(2);
+			mpath = (unsigned char *) xmalloc_a(s->alloc, 2);
 			mpath[0] = j - i;
 			mpath[1] = 0xff;
 			break;
@@ -645,13 +1280,23 @@ static void _scws_mseg_zone(scws_t s, int f, int t)
 		if (i != f && (wmap[i][j]->flag & SCWS_WORD_RULE))
 			continue;
 
+		/* out of budget, drop the paths */
+		if (s->budget > 0 && s->work > s->budget)
+		{
+			if (mpath) xfree_a(s->alloc, mpath);
+			if (npath) xfree_a(s->alloc, npath);
+			_scws_mseg_greedy(s, NULL, f, t);
+			s->work = -1;
+			return;
+		}
+
 		/* create the new path */
 		wmap[i][j]->flag |= SCWS_WORD_USED;
 		nweight = (double) wmap[i][j]->tf * pow(j-i,4);
 
 		if (npath == NULL)
 		{
-			npath = (unsigned char *) malloc(t-f+2);
+			npath = (unsigned char *) xmalloc_a(s->alloc, t-f+2);
 			memset(npath, 0xff, t-f+2);
 		}
 
@@ -701,6 +1346,7 @@ static void _scws_mseg_zone(scws_t s, int f, int t)
 		
 		npath[x] = 0xff;
 		nweight /= pow(x+sz-1,5);
+		s->work += x;
 
 		/* draw the path for debug */
 #ifdef DEBUG
@@ -744,43 +1390,147 @@ static void _scws_mseg_zone(scws_t s, int f, int t)
 	}
 
 	/* 一口.070808: memory leak fixed. */
-	if (mpath) free(mpath);
-	if (npath) free(npath);
+	if (mpath) xfree_a(s->alloc, mpath);
+	if (npath) xfree_a(s->alloc, npath);
 }
 
-/* quick define for zrule_checker in loop */
-#define	___ZRULE_CHECKER1___														\
-if (j >= zlen || SCWS_NO_RULE2(wmap[j][j]->flag))									\
-	break;
-
-#define	___ZRULE_CHECKER2___														\
-if (j < 0 || SCWS_NO_RULE2(wmap[j][j]->flag))										\
-	break;
-
-#define	___ZRULE_CHECKER3___														\
-if (!scws_rule_check(s->r, r1, txt + zmap[j].start, zmap[j].end - zmap[j].start))	\
-	break;
-
-static void _scws_msegment(scws_t s, int end, int zlen)
+/* query the words starting at char i, fill the row i of lattice */
+static void _scws_mset_row(scws_t s, pool_t p, int i, int zlen)
 {
 	word_t **wmap, query;
 	struct scws_zchar *zmap;
 	unsigned char *txt;
-#ifdef HAVE_NAME_RULE	/* 20150403: Remove rules, just deepend on dictionary */
-	rule_item_t r1;
+	int j, k, ch;
+
+	wmap = s->wmap;
+	zmap = s->zmap;
+	txt = s->txt;
+	k = 0;
+	for (j = i+1; j < zlen; j++)
+	{
+		query = xdict_query(s->d, txt + zmap[i].start, zmap[j].end - zmap[i].start);
+		if (query == NULL)
+			break;
+		ch = query->flag;
+		if ((ch & SCWS_WORD_FULL) && memcmp(query->attr, attr_na, 2))
+		{
+			wmap[i][j] = (word_t) pmalloc(p, sizeof(word_st));
+			memcpy(wmap[i][j], query, sizeof(word_st));
+			SCWS_ZMASK_SET(zmap[i].full, j);
+			if (ch & SCWS_WORD_PART)
+				SCWS_ZMASK_SET(zmap[i].part, j);
+
+			wmap[i][i]->flag |= SCWS_ZFLAG_WHEAD;
+
+			for (k = i+1; k <= j; k++)
+				wmap[k][k]->flag |= SCWS_ZFLAG_WPART;
+		}
+
+		if (ch & SCWS_WORD_MALLOCED)
+			xfree(query);
+
+		if (!(ch & SCWS_WORD_PART))
+			break;		
+	}
+	
+	if (k--)
+	{
+		/* set nr2 to some short name */
+		if ((k == (i+1)))
+		{
+			if (!memcmp(wmap[i][k]->attr, attr_nr, 2))
+				wmap[i][i]->flag |= SCWS_ZFLAG_NR2;
+			//if (wmap[i][k]->attr[0] == 'n')
+				//wmap[i][i]->flag |= SCWS_ZFLAG_N2;
+		}				
+
+		/* clean the PART flag for the last word */
+		if (k < j)
+		{
+			wmap[i][k]->flag ^= SCWS_WORD_PART;
+			SCWS_ZMASK_CLR(zmap[i].part, k);
+		}
+	}
+}
+
+/* greedy segment: forward or backward maximum matching on the lattice from f to t,
+ * the rows are built here on demand if pool p is given (forward only) */
+static void _scws_mseg_greedy(scws_t s, pool_t p, int f, int t)
+{
+	unsigned char bpath[SCWS_MAX_ZLEN];
+	int i, j, n;
+
+	if (s->mode & SCWS_GREEDY_BACKWARD)
+	{
+		/* take the longest word ending at j, from the tail to the head */
+		for (n = 0, j = t; j >= f; j = i - 1)
+		{
+			for (i = f; i < j && s->wmap[i][j] == NULL; i++);
+			bpath[n++] = (unsigned char) i;
+		}
+
+		/* put the words in text order */
+		while (n-- > 0)
+		{
+			i = bpath[n];
+			_scws_mset_word(s, i, (n > 0 ? bpath[n-1] - 1 : t));
+		}
+	}
+	else
+	{
+		/* take the longest word starting at i */
+		for (i = f; i <= t; i = j + 1)
+		{
+			if (p != NULL)
+				_scws_mset_row(s, p, i, t + 1);
+			if ((j = _zmask_last(s->zmap[i].full, i+1, t)) < 0)
+				j = i;
+			_scws_mset_word(s, i, j);
+		}
+	}
+}
+
+/* quick define for zrule_checker in loop */
+#define	___ZRULE_CHECKER1___														\
+if (j >= zlen || SCWS_NO_RULE2(wmap[j][j]->flag))									\
+	break;
+
+#define	___ZRULE_CHECKER2___														\
+if (j < 0 || SCWS_NO_RULE2(wmap[j][j]->flag))										\
+	break;
+
+#define	___ZRULE_CHECKER3___														\
+if (!scws_rule_check(s->r, r1, txt + zmap[j].start, zmap[j].end - zmap[j].start))	\
+	break;
+
+static void _scws_msegment(scws_t s, int end, int zlen)
+{
+	word_t **wmap, query;
+	struct scws_zchar *zmap;
+	unsigned char *txt;
+#ifdef HAVE_NAME_RULE	/* 20150403: Remove rules, just deepend on dictionary */
+	rule_item_t r1;
 #endif
-	int i, j, k, ch, clen, start;
+	int i, j, ch, clen, start, lazy;
 	pool_t p;
 
-	/* pool used to management some dynamic memory */
-	p = pool_new();
+	/* pool used to management some dynamic memory, kept by s for the next chunk */
+	if ((p = s->pool) == NULL)
+	{
+		p = s->pool = pool_new();
+		p->alloc = s->alloc;
+	}
 
 	/* create wmap & zmap */
-	wmap = s->wmap = (word_t **) darray_new(zlen, zlen, sizeof(word_t));
-	zmap = s->zmap = (struct scws_zchar *) pmalloc(p, zlen * sizeof(struct scws_zchar));
+	wmap = s->wmap = (word_t **) pmalloc_z(p, zlen * sizeof(word_t *) + zlen * zlen * sizeof(word_t));
+	for (i = 0; i < zlen; i++)
+		wmap[i] = (word_t *) (wmap + zlen) + i * zlen;
+	zmap = s->zmap = (struct scws_zchar *) pmalloc_z(p, zlen * sizeof(struct scws_zchar));
 	txt = s->txt;
 	start = s->off;
 	s->zis = -1;
+	s->wend = -1;
+	s->work = 0;
 
 	for (i = 0; start < end; i++)
 	{
@@ -790,7 +1540,6 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 		{
 			while (start++ < end)
 			{
-				ch = txt[start];
 				if (start == end || SCWS_CHARLEN(txt[start]) > 1)
 					break;
 				clen++;
@@ -802,25 +1551,26 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 		}
 		else
 		{
-			query = xdict_query(s->d, txt + start, clen);
+			query = xdict_query_z(s->d, txt + start, clen);
 			wmap[i][i] = (word_t) pmalloc(p, sizeof(word_st));
 			if (query == NULL)
 			{
 				wmap[i][i]->tf = 0.5;
 				wmap[i][i]->idf = 0.0;
 				wmap[i][i]->flag = 0;
+				wmap[i][i]->id = 0;
 				strcpy(wmap[i][i]->attr, attr_un);
 			}
 			else
 			{
 				ch = query->flag;
-				query->flag = SCWS_WORD_FULL;
 				memcpy(wmap[i][i], query, sizeof(word_st));
+				wmap[i][i]->flag = SCWS_WORD_FULL;
 				if (query->attr[0] == '#')
 					wmap[i][i]->flag |= SCWS_ZFLAG_SYMBOL;
 
 				if (ch & SCWS_WORD_MALLOCED)
-					free(query);							
+					xfree(query);							
 			}
 			start += clen;
 		}
@@ -832,49 +1582,16 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 	/* fixed real zlength */
 	zlen = i;
 
-	/* create word query table */
-	for (i = 0; i < zlen; i++)
+	/* create word query table (built on demand by lazy greedy segment) */
+	lazy = ((s->mode & SCWS_GREEDY_FORWARD) && !(s->mode & SCWS_MULTI_SHORT));
+#ifdef HAVE_NAME_RULE
+	if (s->r != NULL)
+		lazy = 0;
+#endif
+	if (!lazy)
 	{
-		k = 0;
-		for (j = i+1; j < zlen; j++)
-		{
-			query = xdict_query(s->d, txt + zmap[i].start, zmap[j].end - zmap[i].start);
-			if (query == NULL)
-				break;
-			ch = query->flag;
-			if ((ch & SCWS_WORD_FULL) && memcmp(query->attr, attr_na, 2))
-			{
-				wmap[i][j] = (word_t) pmalloc(p, sizeof(word_st));
-				memcpy(wmap[i][j], query, sizeof(word_st));
-
-				wmap[i][i]->flag |= SCWS_ZFLAG_WHEAD;
-
-				for (k = i+1; k <= j; k++)
-					wmap[k][k]->flag |= SCWS_ZFLAG_WPART;
-			}
-
-			if (ch & SCWS_WORD_MALLOCED)
-				free(query);
-
-			if (!(ch & SCWS_WORD_PART))
-				break;		
-		}
-		
-		if (k--)
-		{
-			/* set nr2 to some short name */
-			if ((k == (i+1)))
-			{
-				if (!memcmp(wmap[i][k]->attr, attr_nr, 2))
-					wmap[i][i]->flag |= SCWS_ZFLAG_NR2;
-				//if (wmap[i][k]->attr[0] == 'n')
-					//wmap[i][i]->flag |= SCWS_ZFLAG_N2;
-			}				
-
-			/* clean the PART flag for the last word */
-			if (k < j)
-				wmap[i][k]->flag ^= SCWS_WORD_PART;
-		}
+		for (i = 0; i < zlen; i++)
+			_scws_mset_row(s, p, i, zlen);
 	}
 
 	if (s->r == NULL)
@@ -928,15 +1645,18 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 				if (clen == 1)
 					continue;
 				wmap[i][i+1]->flag |= SCWS_WORD_PART;
+				SCWS_ZMASK_SET(zmap[i].part, i+1);
 			}
 			
 			/* ok, got: i & clen */
 			k = i + clen;
-			wmap[i][k] = (word_t) pmalloc(p, sizeof(word_st));
+			wmap[i][k] = (word_t) pmalloc_z(p, sizeof(word_st));
 			wmap[i][k]->tf = r1->tf;
 			wmap[i][k]->idf = r1->idf;
 			wmap[i][k]->flag = (SCWS_WORD_RULE|SCWS_WORD_FULL);
 			strncpy(wmap[i][k]->attr, r1->attr, 2);
+			SCWS_ZMASK_SET(zmap[i].full, k);
+			SCWS_ZMASK_CLR(zmap[i].part, k);
 
 			wmap[i][i]->flag |= SCWS_ZFLAG_WHEAD;
 			for (j = i+1; j <= k; j++)			
@@ -978,18 +1698,22 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 			if (wmap[k][i] != NULL)
 				continue;
 
-			wmap[k][i] = (word_t) pmalloc(p, sizeof(word_st));
+			wmap[k][i] = (word_t) pmalloc_z(p, sizeof(word_st));
 			wmap[k][i]->tf = r1->tf;
 			wmap[k][i]->idf = r1->idf;
 			wmap[k][i]->flag = SCWS_WORD_FULL;
 			strncpy(wmap[k][i]->attr, r1->attr, 2);
+			SCWS_ZMASK_SET(zmap[k].full, i);
 
 			wmap[k][k]->flag |= SCWS_ZFLAG_WHEAD;
 			for (j = k+1; j <= i; j++)
 			{
 				wmap[j][j]->flag |= SCWS_ZFLAG_WPART;
 				if ((j != i) && (wmap[k][j] != NULL))
+				{
 					wmap[k][j]->flag |= SCWS_WORD_PART;
+					SCWS_ZMASK_SET(zmap[k].part, j);
+				}
 			}
 			continue;
 		}
@@ -1034,13 +1758,16 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 
 			/* ok, got: i & clen */
 			k = k + clen;
-			wmap[i][k] = (word_t) pmalloc(p, sizeof(word_st));
+			wmap[i][k] = (word_t) pmalloc_z(p, sizeof(word_st));
 			wmap[i][k]->tf = r1->tf;
 			wmap[i][k]->idf = r1->idf;
 			wmap[i][k]->flag = SCWS_WORD_FULL;
 			strncpy(wmap[i][k]->attr, r1->attr, 2);
+			SCWS_ZMASK_SET(zmap[i].full, k);
+			SCWS_ZMASK_CLR(zmap[i].part, k);
 
 			wmap[i][i+1]->flag |= SCWS_WORD_PART;
+			SCWS_ZMASK_SET(zmap[i].part, i+1);
 			for (j = i+2; j <= k; j++)			
 				wmap[j][j]->flag |= SCWS_ZFLAG_WPART;
 
@@ -1076,18 +1803,23 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 			/* ok, got: i & clen (maybe clen=1 & [k][i] isset) */
 			k = i - clen;
 			i = i + 1;
-			wmap[k][i] = (word_t) pmalloc(p, sizeof(word_st));
+			wmap[k][i] = (word_t) pmalloc_z(p, sizeof(word_st));
 			wmap[k][i]->tf = r1->tf;
 			wmap[k][i]->idf = r1->idf;
 			wmap[k][i]->flag = SCWS_WORD_FULL;
 			strncpy(wmap[k][i]->attr, r1->attr, 2);
+			SCWS_ZMASK_SET(zmap[k].full, i);
+			SCWS_ZMASK_CLR(zmap[k].part, i);
 
 			wmap[k][k]->flag |= SCWS_ZFLAG_WHEAD;
 			for (j = k+1; j <= i; j++)
 			{
 				wmap[j][j]->flag |= SCWS_ZFLAG_WPART;
 				if (wmap[k][j] != NULL)
+				{
 					wmap[k][j]->flag |= SCWS_WORD_PART;
+					SCWS_ZMASK_SET(zmap[k].part, j);
+				}
 			}
 
 			i -= (clen+1);
@@ -1099,40 +1831,56 @@ static void _scws_msegment(scws_t s, int end, int zlen)
 	/* real do the segment */
 do_segment:
 
-	/* find the easy break point */
-	for (i = 0, j = 0; i < zlen; i++)
+	/* greedy mode: maximum matching without path scoring */
+
+	if (s->mode & SCWS_GREEDY_MASK)
+		_scws_mseg_greedy(s, (lazy ? p : NULL), 0, zlen - 1);
+	else
 	{
-		if (wmap[i][i]->flag & SCWS_ZFLAG_WPART)
-			continue;
+		/* find the easy break point */
+		for (i = 0, j = 0; i < zlen; i++)
+		{
+			if (wmap[i][i]->flag & SCWS_ZFLAG_WPART)
+				continue;
+
+			if (i > j)
+				_scws_mseg_zone(s, j, i-1);
+
+			j = i;
+			if (!(wmap[i][i]->flag & SCWS_ZFLAG_WHEAD))
+			{
+				_scws_mset_word(s, i, i);
+				j++;
+			}
+		}
 
+		/* the lastest zone */
 		if (i > j)
 			_scws_mseg_zone(s, j, i-1);
 
-		j = i;
-		if (!(wmap[i][i]->flag & SCWS_ZFLAG_WHEAD))
-		{
-			_scws_mset_word(s, i, i);
-			j++;
-		}
+		/* report the degraded chunk */
+		if (s->work < 0)
+			s->degraded++;
 	}
 
-	/* the lastest zone */
-	if (i > j)
-		_scws_mseg_zone(s, j, i-1);
-
 	/* the last single for duality */
 	if ((s->mode & SCWS_DUALITY) && (s->zis >= 0) && !(s->zis & SCWS_ZIS_USED))	
 	{
 		i = s->zis;
-		SCWS_PUT_RES(s->zmap[i].start, s->wmap[i][i]->idf, (s->zmap[i].end - s->zmap[i].start), s->wmap[i][i]->attr);
+		SCWS_PUT_RES(s->zmap[i].start, s->wmap[i][i]->idf, (s->zmap[i].end - s->zmap[i].start), s->wmap[i][i]->attr, s->wmap[i][i]->id);
 	}
 
 	/* free the wmap & zmap */
-	pool_free(p);
-	darray_free((void **) wmap);
+	pool_reset(p);
 }
 
-scws_res_t scws_get_result(scws_t s)
+/* scan the chunk from s->off, return the end offset (*rend: before dropping a half char),
+ * it is instantiated for each charset, the right one is chosen once in scws_set_charset */
+#define	SCWS_SCAN_CHARLEN(x)	(cs == SCWS_CS_GBK ? (((x) >= 0x81 && (x) <= 0xfe) ? 2 : 1)		\
+	: (cs == SCWS_CS_UTF8 ? ((x) < 0xc0 ? 1 : (x) < 0xe0 ? 2 : (x) < 0xf0 ? 3 : (x) < 0xf8 ? 4	\
+	: (x) < 0xfc ? 5 : (x) < 0xfe ? 6 : 1) : SCWS_CHARLEN(x)))
+
+static inline int _scws_scan_chunk(scws_t s, int *zlen_p, int *pflag_p, int *rend, const int cs)
 {
 	int off, len, ch, clen, zlen, pflag;
 	unsigned char *txt;
@@ -1140,38 +1888,37 @@ scws_res_t scws_get_result(scws_t s)
 	off = s->off;
 	len = s->len;
 	txt = s->txt;
-	s->res0 = s->res1 = NULL;
-	while ((off < len) && (txt[off] <= 0x20))
-	{
-		if (txt[off] == 0x0a || txt[off] == 0x0d)
-		{
-			s->off = off + 1;
-			SCWS_PUT_RES(off, 0.0, 1, attr_un);
-			return s->res0;
-		}
-		off++;
-	}
-
-	if (off >= len)
-		return NULL;
-
-	/* try to parse the sentence */
-	s->off = off;
 	ch = txt[off];
-	if (SCWS_CHAR_TOKEN(ch) && !(s->mode & SCWS_IGN_SYMBOL))
-	{
-		s->off++;
-		SCWS_PUT_RES(off, 0.0, 1, attr_un);
-		return s->res0;
-	}
-	clen = SCWS_CHARLEN(ch);
+	clen = SCWS_SCAN_CHARLEN(ch);
 	zlen = 1;
 	pflag = (clen > 1 ? PFLAG_WITH_MB : (SCWS_IS_ALNUM(ch) ? PFLAG_ALNUM : 0));
 	while ((off = (off+clen)) < len)
 	{
+		/* pass the plain ascii run in blocks, the same as byte by byte below */
+		if (!(pflag & PFLAG_WITH_MB) && zlen < (SCWS_MAX_ZLEN - 1))
+		{
+			int k, na, pairs;
+
+			k = SCWS_MAX_ZLEN - 1 - zlen;
+			if ((k = xclass_ascii_run(txt + off, (len - off) < k ? (len - off) : k, &na, &pairs)) > 0)
+			{
+				if (pflag & PFLAG_ALNUM)
+				{
+					if (pairs & XCLASS_ALPHA2)
+						pflag |= PFLAG_LONGALPHA;
+					if (pairs & XCLASS_DIGIT2)
+						pflag |= PFLAG_LONGDIGIT;
+					if (na < k)
+						pflag ^= PFLAG_ALNUM;
+				}
+				zlen += k;
+				clen = k;
+				continue;
+			}
+		}
 		ch = txt[off];
 		if (ch <= 0x20 || SCWS_CHAR_TOKEN(ch)) break;		
-		clen = SCWS_CHARLEN(ch);
+		clen = SCWS_SCAN_CHARLEN(ch);
 		if (!(pflag & PFLAG_WITH_MB))
 		{
 			// pure single-byte -> multibyte (2bytes)
@@ -1214,8 +1961,7 @@ scws_res_t scws_get_result(scws_t s)
 			// 夹在中文间的英文数字最多允许 2 个字符 (超过2可以独立成词没啥问题)
 			for (i = off+1; i < (off+3); i++)
 			{
-				ch = txt[i];
-				if ((i >= len) || (ch <= 0x20) || (SCWS_CHARLEN(ch) > 1))
+				if ((i >= len) || ((ch = txt[i]) <= 0x20) || (SCWS_SCAN_CHARLEN(ch) > 1))
 				{
 					pflag |= PFLAG_VALID;
 					break;
@@ -1236,14 +1982,155 @@ scws_res_t scws_get_result(scws_t s)
 	}
 
 	/* hightman.070624: 处理半个字的问题 */
-	if ((ch = off) > len)	
+	if ((*rend = off) > len)	
 		off -= clen;
 
+	*zlen_p = zlen;
+	*pflag_p = pflag;
+	return off;
+}
+
+static int _scws_scan_gbk(scws_t s, int *zlen, int *pflag, int *rend)
+{
+	return _scws_scan_chunk(s, zlen, pflag, rend, SCWS_CS_GBK);
+}
+
+static int _scws_scan_utf8(scws_t s, int *zlen, int *pflag, int *rend)
+{
+	return _scws_scan_chunk(s, zlen, pflag, rend, SCWS_CS_UTF8);
+}
+
+static int _scws_scan_table(scws_t s, int *zlen, int *pflag, int *rend)
+{
+	return _scws_scan_chunk(s, zlen, pflag, rend, SCWS_CS_TABLE);
+}
+
+/* fnv-1a of the chunk bytes */
+static inline unsigned int _scws_cache_hash(const unsigned char *p, int len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len--)
+	{
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* put the cached results of the chunk from s->off to end, return 0 if missed */
+static int _scws_cache_get(scws_t s, int end, unsigned int hash)
+{
+	struct scws_cache_ent *ent;
+	struct scws_token *tk;
+	int i, klen;
+
+	klen = end - s->off;
+	ent = &s->cache->ents[hash & (s->cache->size - 1)];
+	if (ent->data == NULL || ent->hash != hash || ent->klen != klen
+		|| ent->mode != (s->mode & ~SCWS_DEBUG) || ent->budget != s->budget
+		|| memcmp(ent->data + ent->ntok, s->txt + s->off, klen))
+	{
+		s->cache->misses++;
+		return 0;
+	}
+
+	s->cache->hits++;
+	for (i = 0, tk = ent->data; i < ent->ntok; i++, tk++)
+	{
+		s->view = tk->view;
+		SCWS_PUT_RES(s->off + tk->off, tk->idf, tk->len, tk->attr, tk->id);
+	}
+	s->view = SCWS_VIEW_BASE;
+	s->degraded += ent->degraded;
+	return 1;
+}
+
+/* save the results of the chunk just segmented */
+static void _scws_cache_put(scws_t s, int end, unsigned int hash)
+{
+	struct scws_cache_ent *ent;
+	struct scws_token *tk;
+	scws_res_t cur;
+	int n;
+
+	for (n = 0, cur = s->res0; cur != NULL; cur = cur->next)
+		n++;
+
+	ent = &s->cache->ents[hash & (s->cache->size - 1)];
+	if (ent->data != NULL)
+		xfree_a(s->alloc, ent->data);
+	ent->hash = hash;
+	ent->mode = s->mode & ~SCWS_DEBUG;
+	ent->budget = s->budget;
+	ent->klen = end - s->off;
+	ent->ntok = n;
+	ent->degraded = (s->work < 0 ? 1 : 0);
+	ent->data = (struct scws_token *) xmalloc_a(s->alloc, sizeof(struct scws_token) * n + ent->klen);
+	for (tk = ent->data, cur = s->res0; cur != NULL; cur = cur->next, tk++)
+	{
+		tk->off = cur->off - s->off;
+		tk->idf = cur->idf;
+		tk->len = ((struct scws_result_ex *) cur)->len;
+		memcpy(tk->attr, cur->attr, 3);
+		tk->view = ((struct scws_result_ex *) cur)->view;
+		tk->id = cur->id;
+	}
+	memcpy(tk, s->txt + s->off, ent->klen);
+}
+
+static scws_res_t _scws_get_result(scws_t s)
+{
+	int off, len, ch, zlen, pflag;
+	unsigned char *txt;
+
+	off = s->off;
+	len = s->len;
+	txt = s->txt;
+	s->res0 = s->res1 = NULL;
+	while ((off < len) && (txt[off] <= 0x20))
+	{
+		if (txt[off] == 0x0a || txt[off] == 0x0d)
+		{
+			s->off = off + 1;
+			SCWS_PUT_RES(off, 0.0, 1, attr_un, 0);
+			return s->res0;
+		}
+		off += xclass_blank_run(txt + off, len - off);
+	}
+
+	if (off >= len)
+		return NULL;
+
+	/* try to parse the sentence */
+	s->off = off;
+	ch = txt[off];
+	if (SCWS_CHAR_TOKEN(ch) && !(s->mode & SCWS_IGN_SYMBOL))
+	{
+		s->off++;
+		SCWS_PUT_RES(off, 0.0, 1, attr_un, 0);
+		return s->res0;
+	}
+	off = s->scan(s, &zlen, &pflag, &ch);
+
 	/* do the real segment */
 	if (off <= s->off)
 		return NULL;
 	else if (pflag & PFLAG_WITH_MB)
-		_scws_msegment(s, off, zlen);
+	{
+		if (s->cache == NULL)
+			_scws_msegment(s, off, zlen);
+		else
+		{
+			unsigned int hash = _scws_cache_hash(txt + s->off, off - s->off);
+
+			if (!_scws_cache_get(s, off, hash))
+			{
+				_scws_msegment(s, off, zlen);
+				_scws_cache_put(s, off, hash);
+			}
+		}
+	}
 	else if (!(pflag & PFLAG_ALNUM) || ((off - s->off) >= SCWS_MAX_EWLEN))
 		_scws_ssegment(s, off);
 	else
@@ -1256,22 +2143,68 @@ scws_res_t scws_get_result(scws_t s)
 			float idf;
 
 			idf = SCWS_EN_IDF(zlen);
-			SCWS_PUT_RES(s->off, idf, zlen, attr_en);
+			SCWS_PUT_RES(s->off, idf, zlen, attr_en, 0);
 		
 			/* hightman.090523: 为字母数字混合再度拆解, 纯数字, (>1 ? 纯字母 : 数字+字母) */
 			if ((s->mode & SCWS_MULTI_DUALITY) && zlen > 2)
+			{
+				s->view = SCWS_VIEW_DUALITY;
 				_scws_alnum_multi(s, s->off, zlen);
+				s->view = SCWS_VIEW_BASE;
+			}
 		}
 	}
 
 	/* reutrn the result */
 	s->off = (ch > len ? len : off);
 	if (s->res0 == NULL)
-		return scws_get_result(s);
+		return _scws_get_result(s);
 
 	return s->res0;
 }
 
+/* map the offsets of the converted text back to the text sent */
+static void _scws_xc_map(scws_t s, scws_res_t res)
+{
+	int *omap = s->xc->omap;
+	int end;
+
+	for (; res != NULL; res = res->next)
+	{
+		end = omap[res->off + ((struct scws_result_ex *) res)->len];
+		res->off = omap[res->off];
+		res->len = ((struct scws_result_ex *) res)->len = end - res->off;
+	}
+}
+
+/* the offset in the converted text of off in the text sent (a char boundary) */
+static int _scws_xc_txt_off(scws_t s, int off)
+{
+	int lo, hi, mid;
+
+	if (!SCWS_XC_ON(s))
+		return off;
+	for (lo = 0, hi = s->len; lo < hi; )
+	{
+		mid = (lo + hi) >> 1;
+		if (s->xc->omap[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+scws_res_t scws_get_result(scws_t s)
+{
+	scws_res_t res;
+
+	res = _scws_get_result(s);
+	if (SCWS_XC_ON(s))
+		_scws_xc_map(s, res);
+	return res;
+}
+
 /* free the result retunned by scws_get_result */
 void scws_free_result(scws_res_t result)
 {
@@ -1280,286 +2213,987 @@ void scws_free_result(scws_res_t result)
 	while ((cur = result) != NULL)
 	{
 		result = cur->next;
-		free(cur);
+		xfree_a(((struct scws_result_ex *) cur)->alloc, cur);
 	}
 }
 
-/* top words count */
-// xattr = ~v,p,c
-// xattr = v,pn,c
-
-static int _tops_cmp(a, b)
-	scws_top_t *a,*b;
+int scws_res_view(scws_res_t res)
 {
-	if ((*b)->weight > (*a)->weight)
-		return 1;
-	return -1;
+	return (int) ((struct scws_result_ex *) res)->view;
 }
 
-static void _tops_load_node(node_t node, scws_top_t *values, scws_io_size_t *start)
+/* copy res to a 64-bit chain with the offsets from base, res is freed */
+static scws_res64_t _scws_result64(scws_t s, scws_res_t res, size_t base)
 {
-	int i = *start;
+	scws_res_t cur;
+	scws_res64_t head, tail, x;
 
-	if (node == NULL)
-		return;
-	
-	values[i] = node->value;
-	values[i]->word = node->key;
+	head = tail = NULL;
+	for (cur = res; cur != NULL; cur = cur->next)
+	{
+		x = (scws_res64_t) xmalloc_o(s->alloc, sizeof(struct scws_result64));
+		x->off = base + (size_t) cur->off;
+		x->idf = cur->idf;
+		x->len = ((struct scws_result_ex *) cur)->len;
+		memcpy(x->attr, cur->attr, 3);
+		x->view = ((struct scws_result_ex *) cur)->view;
+		x->id = cur->id;
+		x->next = NULL;
+		if (tail == NULL)
+			head = x;
+		else
+			tail->next = x;
+		tail = x;
+	}
+	scws_free_result(res);
+	return head;
+}
+
+scws_res64_t scws_get_result64(scws_t s)
+{
+	scws_res_t res;
 
-	*start = ++i;
-	_tops_load_node(node->left, values, start);
-	_tops_load_node(node->right, values, start);
+	/* go to the next window */
+	while ((res = scws_get_result(s)) == NULL)
+	{
+		if ((s->xbase + s->len) >= s->xlen)
+			return NULL;
+		s->txt += s->len;
+		s->xbase += s->len;
+		s->off = 0;
+		s->len = _scws_window(s, s->xlen - s->xbase);
+		SCWS_TOK_RESET(s);
+	}
+	return _scws_result64(s, res, s->xbase);
 }
 
-static void _tops_load_all(xtree_t xt, scws_top_t *values)
+void scws_free_result64(scws_res64_t result)
 {
-	for (scws_io_size_t i = 0, start = 0; i < xt->prime; i++)	
-		_tops_load_node(xt->trees[i], values, &start);
+	scws_res64_t cur;
+
+	while ((cur = result) != NULL)
+	{
+		result = cur->next;
+		xfree_o(cur);
+	}
 }
 
-typedef char word_attr[4];
-static inline int _attr_belong(const char *a, word_attr *at)
+/* segment all the rest text, return the whole chain & save its tail */
+static scws_res_t _scws_get_result_all(scws_t s, scws_res_t *tail)
 {
-	if ((*at)[0] == '\0') return 1;	
-	while ((*at)[0])
+	scws_res_t head, res;
+
+	head = *tail = NULL;
+	while ((res = scws_get_result(s)) != NULL)
 	{
-		if (!strcmp(a, *at)) return 1;
-		at++;
+		if (head == NULL)
+			head = res;
+		else
+			(*tail)->next = res;
+		*tail = s->res1;
 	}
-	return 0;
+	return head;
 }
 
-/* macro to parse xattr -> xmode, at */
-#define	__PARSE_XATTR__		do {						\
-	if (xattr == NULL) break;							\
-	if (*xattr == '~') { xattr++; xmode = SCWS_YEA; }	\
-	if (*xattr == '\0') break;							\
-	cnt = ((strlen(xattr)/2) + 2) * sizeof(word_attr);	\
-	at = (word_attr *) malloc(cnt);						\
-	memset(at, 0, cnt);									\
-	cnt = 0;											\
-	for (cnt = 0; (word = strchr(xattr, ',')); cnt++) {	\
-		at[cnt][0] = *xattr++;							\
-		at[cnt][1] = xattr == word ? '\0' : *xattr;		\
-		xattr = word + 1;								\
-	}													\
-	strncpy(at[cnt], xattr, 2);							\
-} while (0)
+/* parallel segment (split the text into pieces at safe break points) */
+#define	SCWS_MT_MIN_PIECE		65536
+#define	SCWS_MT_PIECE_PER_THREAD	4
 
-scws_top_t scws_get_tops(scws_t s, int limit, const char *xattr)
+struct scws_mt_piece
 {
-	int off, cnt, xmode = SCWS_NA;
-	xtree_t xt;	
-	scws_res_t res, cur;
-	scws_top_t top, *list, tail, base;
-	char *word;
-	word_attr *at = NULL;
-
-	if (!s || !s->txt || !(xt = xtree_new(0,1)))
-		return NULL;
+	int start;
+	int end;
+	scws_res_t res0;
+	scws_res_t res1;
+};
 
-	__PARSE_XATTR__;
+struct scws_mt_job
+{
+	scws_t s;		/* forked engine of this worker */
+	volatile int *next;
+	int npiece;
+	struct scws_mt_piece *pieces;
+};
+
+/* a whitespace always breaks the chunk in scws_get_result, so the text after it can be
+ * segmented alone. step by chars from a chunk start, the trail bytes are never taken as space */
+static int _scws_mt_boundary(scws_t s, int off, int min, int len)
+{
+	unsigned char *txt = s->txt;
 
-	// save the offset.
-	off = s->off;
-	s->off = cnt = 0;
-	while ((cur = res = scws_get_result(s)) != NULL)
+	for (; off < len; off += SCWS_CHARLEN(txt[off]))
 	{
-		do
-		{
-			if (cur->idf < 0.2 || cur->attr[0] == '#')
-				continue;
+		if (off >= min && txt[off] <= 0x20)
+			return off + 1;
+	}
+	return len;
+}
 
-			/* check attribute filter */
-			if (at != NULL)
-			{
-				if ((xmode == SCWS_NA) && !_attr_belong(cur->attr, at))
-					continue;
+static void *_scws_mt_worker(void *arg)
+{
+	struct scws_mt_job *job = (struct scws_mt_job *) arg;
+	struct scws_mt_piece *pc;
+	int k;
 
-				if ((xmode == SCWS_YEA) && _attr_belong(cur->attr, at))
-					continue;
-			}
+	while ((k = xthread_atomic_add(job->next, 1) - 1) < job->npiece)
+	{
+		pc = &job->pieces[k];
+		job->s->len = pc->end;
+		job->s->off = pc->start;
+		pc->res0 = _scws_get_result_all(job->s, &pc->res1);
+	}
+	return NULL;
+}
+
+scws_res_t scws_get_result_mt(scws_t s, int threads)
+{
+	struct scws_mt_piece *pieces;
+	struct scws_mt_job *jobs;
+	xthread_t *tids;
+	scws_res_t head, tail;
+	volatile int next;
+	int i, k, n, off, psize;
+
+	if (!s || !s->txt || s->off >= s->len)
+		return NULL;
+
+	if (threads <= 0)
+		threads = xthread_ncpu();
+	if (threads > ((s->len - s->off) / SCWS_MT_MIN_PIECE))
+		threads = (s->len - s->off) / SCWS_MT_MIN_PIECE;
+
+	/* too small to split */
+	if (threads <= 1)
+		return _scws_get_result_all(s, &tail);
+
+	/* split the text */
+	n = threads * SCWS_MT_PIECE_PER_THREAD;
+	psize = (s->len - s->off) / n;
+	pieces = (struct scws_mt_piece *) xmalloc_a(s->alloc, sizeof(struct scws_mt_piece) * n);
+	jobs = (struct scws_mt_job *) xmalloc_a(s->alloc, sizeof(struct scws_mt_job) * threads);
+	tids = (xthread_t *) xmalloc_a(s->alloc, sizeof(xthread_t) * threads);
+	if (pieces == NULL || jobs == NULL || tids == NULL)
+	{
+		i = 0;
+		goto mt_fallback;
+	}
+	for (k = 0, off = s->off; k < n && off < s->len; k++)
+	{
+		pieces[k].start = off;
+		pieces[k].res0 = pieces[k].res1 = NULL;
+		off = (k == (n - 1) ? s->len : _scws_mt_boundary(s, off, off + psize, s->len));
+		pieces[k].end = off;
+	}
+	n = k;
+
+	/* fork the engines here (not in the threads), the main thread works too */
+	next = 0;
+	for (i = 0; i < threads; i++)
+	{
+		if ((jobs[i].s = scws_fork(s)) == NULL)
+			goto mt_fallback;
+		jobs[i].s->txt = s->txt;
+		jobs[i].next = &next;
+		jobs[i].npiece = n;
+		jobs[i].pieces = pieces;
+	}
+	for (i = k = 1; i < threads; i++)
+	{
+		if (xthread_create(&tids[k], _scws_mt_worker, &jobs[i]) == 0)
+			k++;
+	}
+	_scws_mt_worker(&jobs[0]);
+	while (--k > 0)
+		xthread_join(tids[k]);
 
-			/* check stopwords */
-			if (!strncmp(cur->attr, attr_en, 2) && cur->len > 6)
+	/* link the pieces in text order */
+	head = tail = NULL;
+	for (k = 0; k < n; k++)
+	{
+		if (pieces[k].res0 == NULL)
+			continue;
+		if (head == NULL)
+			head = pieces[k].res0;
+		else
+			tail->next = pieces[k].res0;
+		tail = pieces[k].res1;
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		s->degraded += jobs[i].s->degraded;
+		scws_free(jobs[i].s);
+	}
+	if (SCWS_XC_ON(s))
+		_scws_xc_map(s, head);
+	xfree_a(s->alloc, tids);
+	xfree_a(s->alloc, jobs);
+	xfree_a(s->alloc, pieces);
+
+	s->off = s->len;
+	return head;
+
+mt_fallback:
+	/* out of memory: free the i engines forked, segment it on this thread */
+	while (i-- > 0)
+		scws_free(jobs[i].s);
+	if (tids != NULL)
+		xfree_a(s->alloc, tids);
+	if (jobs != NULL)
+		xfree_a(s->alloc, jobs);
+	if (pieces != NULL)
+		xfree_a(s->alloc, pieces);
+	return _scws_get_result_all(s, &tail);
+}
+
+/* batch segment: each worker owns a block of docs and takes SCWS_BATCH_GRAIN of them per step,
+ * the idle worker steals from the others' blocks by the same atomic cursor */
+#define	SCWS_BATCH_GRAIN	16
+
+struct scws_batch_job
+{
+	scws_t s;
+	volatile int next;		/* cursor of the own block */
+	int end;
+	int total;				/* tokens in res */
+	int size;
+	int fail;				/* out of memory */
+	struct scws_result_ex *res;	/* the views are kept till the output */
+};
+
+struct scws_batch_ctx
+{
+	const char **docs;
+	const int *lens;
+	int *dcnt;				/* tokens of each doc */
+	int *dpos;				/* offset in the res of worker */
+	unsigned char *dwid;	/* worker of each doc */
+	int njob;
+	struct scws_batch_job *jobs;
+};
+
+struct scws_batch_arg
+{
+	struct scws_batch_ctx *ctx;
+	int wid;
+};
+
+static void _scws_batch_doc(struct scws_batch_ctx *ctx, int wid, int i)
+{
+	struct scws_batch_job *job = &ctx->jobs[wid];
+	scws_res_t res, cur;
+	int len;
+
+	len = (ctx->lens == NULL ? strlen(ctx->docs[i]) : ctx->lens[i]);
+	scws_send_text(job->s, ctx->docs[i], len);
+	ctx->dpos[i] = job->total;
+	ctx->dwid[i] = (unsigned char) wid;
+	while ((cur = res = scws_get_result(job->s)) != NULL)
+	{
+		while (cur != NULL)
+		{
+			if (job->total == job->size && !job->fail)
 			{
-				word = _mem_ndup(s->txt + cur->off, cur->len);
-				_str_tolower(word, word);
-				if (SCWS_IS_NOSTATS(word, cur->len))
+				struct scws_result_ex *tmp;
+				int size = (job->size == 0 ? 1024 : job->size << 1);
+
+				tmp = (struct scws_result_ex *) xrealloc_a(job->s->alloc, job->res, sizeof(struct scws_result_ex) * size);
+				if (tmp == NULL)
+					job->fail = 1;
+				else
 				{
-					free(word);
-					continue;
+					job->res = tmp;
+					job->size = size;
 				}
-				free(word);
 			}
+			if (!job->fail)
+				job->res[job->total++] = *((struct scws_result_ex *) cur);
+			cur = cur->next;
+		}
+		scws_free_result(res);
+	}
+	ctx->dcnt[i] = job->total - ctx->dpos[i];
+}
 
-			/* put to the stats */
-			if (!(top = xtree_nget(xt, s->txt + cur->off, cur->len, NULL)))
-			{
-				top = (scws_top_t) pmalloc_z(xt->p, sizeof(struct scws_topword));
-				top->weight = cur->idf;
-				top->times = 1;
-				strncpy(top->attr, cur->attr, 2);
-				xtree_nput(xt, top, sizeof(struct scws_topword), s->txt + cur->off, cur->len);
-				cnt++;
-			}
-			else
+static void *_scws_batch_worker(void *arg)
+{
+	struct scws_batch_ctx *ctx = ((struct scws_batch_arg *) arg)->ctx;
+	struct scws_batch_job *job;
+	int wid, i, k, end;
+
+	wid = ((struct scws_batch_arg *) arg)->wid;
+	for (i = 0; i < ctx->njob; i++)
+	{
+		/* own block first, then steal */
+		job = &ctx->jobs[(wid + i) % ctx->njob];
+		while ((k = xthread_atomic_add(&job->next, SCWS_BATCH_GRAIN) - SCWS_BATCH_GRAIN) < job->end)
+		{
+			end = k + SCWS_BATCH_GRAIN;
+			if (end > job->end)
+				end = job->end;
+			for (; k < end; k++)
+				_scws_batch_doc(ctx, wid, k);
+		}
+	}
+	return NULL;
+}
+
+scws_batch_t scws_segment_batch(scws_t s, const char **docs, const int *lens, int num, int threads)
+{
+	struct scws_batch_ctx ctx;
+	struct scws_batch_arg *args;
+	struct scws_result_ex *res;
+	scws_batch_t b;
+	xthread_t *tids;
+	int i, j, k, n;
+
+	if (!s || num < 0 || (num > 0 && docs == NULL))
+		return NULL;
+
+	if (threads <= 0)
+		threads = xthread_ncpu();
+	if (threads > 255)
+		threads = 255;
+	if (threads > (num / SCWS_BATCH_GRAIN))
+		threads = (num / SCWS_BATCH_GRAIN) > 0 ? (num / SCWS_BATCH_GRAIN) : 1;
+
+	b = NULL;
+	ctx.docs = docs;
+	ctx.lens = lens;
+	ctx.dcnt = (int *) xmalloc_a(s->alloc, sizeof(int) * (num + 1) * 2);
+	ctx.dwid = (unsigned char *) xmalloc_a(s->alloc, num + 1);
+	ctx.njob = threads;
+	ctx.jobs = (struct scws_batch_job *) xmalloc_a(s->alloc, threads * sizeof(struct scws_batch_job));
+	if (ctx.jobs != NULL)
+		memset(ctx.jobs, 0, threads * sizeof(struct scws_batch_job));
+	args = (struct scws_batch_arg *) xmalloc_a(s->alloc, sizeof(struct scws_batch_arg) * threads);
+	tids = (xthread_t *) xmalloc_a(s->alloc, sizeof(xthread_t) * threads);
+	if (ctx.dcnt == NULL || ctx.dwid == NULL || ctx.jobs == NULL || args == NULL || tids == NULL)
+		goto batch_end;
+	ctx.dpos = ctx.dcnt + num + 1;
+
+	/* fork the engines & share the docs */
+	for (i = 0; i < threads; i++)
+	{
+		if ((ctx.jobs[i].s = scws_fork(s)) == NULL)
+			goto batch_end;
+		ctx.jobs[i].next = (int) (((long long) num * i) / threads);
+		ctx.jobs[i].end = (int) (((long long) num * (i + 1)) / threads);
+		args[i].ctx = &ctx;
+		args[i].wid = i;
+	}
+	for (i = k = 1; i < threads; i++)
+	{
+		if (xthread_create(&tids[k], _scws_batch_worker, &args[i]) == 0)
+			k++;
+	}
+	_scws_batch_worker(&args[0]);
+	while (--k > 0)
+		xthread_join(tids[k]);
+
+	/* copy into the contiguous output in doc order */
+	for (i = n = 0; i < threads; i++)
+	{
+		if (ctx.jobs[i].fail)
+			goto batch_end;
+		n += ctx.jobs[i].total;
+	}
+	if ((b = (scws_batch_t) xmalloc_o(s->alloc, sizeof(struct scws_batch) + sizeof(int) * (num + 1 + n) + n)) == NULL)
+		goto batch_end;
+	if ((b->res = (struct scws_result *) xmalloc_o(s->alloc, sizeof(struct scws_result) * (n > 0 ? n : 1))) == NULL)
+	{
+		xfree_o(b);
+		b = NULL;
+		goto batch_end;
+	}
+	b->num = num;
+	b->total = n;
+	b->index = (int *) (b + 1);
+	b->len = (unsigned int *) (b->index + num + 1);
+	b->view = (unsigned char *) (b->len + n);
+	for (i = n = 0; i < num; i++)
+	{
+		b->index[i] = n;
+		res = ctx.jobs[ctx.dwid[i]].res + ctx.dpos[i];
+		for (j = 0; j < ctx.dcnt[i]; j++, n++)
+		{
+			b->res[n] = res[j].r;
+			b->view[n] = res[j].view;
+			b->len[n] = res[j].len;
+			b->res[n].next = (j == (ctx.dcnt[i] - 1) ? NULL : &b->res[n + 1]);
+		}
+	}
+	b->index[num] = n;
+
+batch_end:
+	/* b is NULL if anything failed, the jobs not forked are zero */
+	for (i = 0; ctx.jobs != NULL && i < threads && ctx.jobs[i].s != NULL; i++)
+	{
+		scws_free(ctx.jobs[i].s);
+		if (ctx.jobs[i].res != NULL)
+			xfree_a(s->alloc, ctx.jobs[i].res);
+	}
+	xfree_a(s->alloc, tids);
+	xfree_a(s->alloc, args);
+	xfree_a(s->alloc, ctx.jobs);
+	xfree_a(s->alloc, ctx.dwid);
+	xfree_a(s->alloc, ctx.dcnt);
+
+	return b;
+}
+
+void scws_free_batch(scws_batch_t b)
+{
+	if (b != NULL)
+	{
+		xfree_o(b->res);
+		xfree_o(b);
+	}
+}
+
+/* streaming input: the pending text is only segmented up to the last whitespace (a chunk
+ * break of scws_get_result), longer text without any space is cut at a char boundary */
+#define	SCWS_STREAM_MAXPEND		65536
+
+scws_stream_t scws_stream_new(scws_t s)
+{
+	scws_stream_t st;
+
+	// the pushed text is not converted
+	if (s == NULL || s->xc != NULL)
+		return NULL;
+
+	st = (scws_stream_t) xmalloc_a(s->alloc, sizeof(scws_stream_st));
+	memset(st, 0, sizeof(scws_stream_st));
+	st->s = scws_fork(s);
+	return st;
+}
+
+void scws_stream_push(scws_stream_t st, const char *data, int len)
+{
+	if (len <= 0 || st->eof)
+		return;
+
+	/* drop the segmented text, results of it are not valid any more */
+	if (st->off > 0)
+	{
+		st->len -= st->off;
+		st->cut -= st->off;
+		st->scan -= st->off;
+		st->base += st->off;
+		memmove(st->buf, st->buf + st->off, st->len);
+		st->off = 0;
+	}
+	// keep a spare byte for the trailing '\0'
+	if ((st->len + len) >= st->size)
+	{
+		st->size = (st->len + len) >= (st->size << 1) ? (st->len + len + 1) : (st->size << 1);
+		st->buf = (unsigned char *) xrealloc_a(st->s->alloc, st->buf, st->size);
+	}
+	memcpy(st->buf + st->len, data, len);
+	st->len += len;
+	st->buf[st->len] = '\0';
+}
+
+/* no more data, the rest text (even half char) will be segmented */
+void scws_stream_end(scws_stream_t st)
+{
+	st->eof = 1;
+}
+
+/* end of the segmentable text in buf, scan by chars from the last scanned char */
+static int _scws_stream_cut(scws_stream_t st)
+{
+	scws_t s = st->s;
+	unsigned char *txt = st->buf;
+	int off, clen, cut;
+
+	if (st->eof)
+		return st->len;
+
+	cut = st->off;
+	for (off = (st->scan > st->off ? st->scan : st->off); off < st->len; off += clen)
+	{
+		clen = SCWS_CHARLEN(txt[off]);
+		if ((off + clen) > st->len)
+			break;
+		if (txt[off] <= 0x20)
+			cut = off + 1;
+	}
+	st->scan = off;
+
+	/* too long without any space, cut at the last whole char */
+	if (cut == st->off && (st->scan - st->off) >= SCWS_STREAM_MAXPEND)
+		cut = st->scan;
+
+	return cut;
+}
+
+/* the next result with the offsets in buf */
+static scws_res_t _scws_stream_result(scws_stream_t st)
+{
+	scws_t s = st->s;
+	scws_res_t res;
+	int cut;
+
+	if (st->off >= st->cut || st->eof)
+		st->cut = _scws_stream_cut(st);
+	if ((cut = st->cut) <= st->off)
+		return NULL;
+
+	s->txt = st->buf;
+	s->off = st->off;
+	s->len = cut;
+	res = scws_get_result(s);
+	st->off = (res == NULL ? cut : s->off);
+	return res;
+}
+
+scws_res_t scws_stream_get_result(scws_stream_t st)
+{
+	scws_res_t res, cur;
+
+	res = _scws_stream_result(st);
+	for (cur = res; cur != NULL; cur = cur->next)
+		cur->off += (int) st->base;
+	return res;
+}
+
+scws_res64_t scws_stream_get_result64(scws_stream_t st)
+{
+	scws_res_t res;
+
+	if ((res = _scws_stream_result(st)) == NULL)
+		return NULL;
+	return _scws_result64(st->s, res, st->base);
+}
+
+const char *scws_stream_word(scws_stream_t st, scws_res_t res)
+{
+	if ((size_t) res->off < st->base || ((size_t) res->off + res->len) > (st->base + st->len))
+		return NULL;
+	return (const char *) st->buf + ((size_t) res->off - st->base);
+}
+
+const char *scws_stream_word64(scws_stream_t st, scws_res64_t res)
+{
+	if (res->off < st->base || (res->off + res->len) > (st->base + st->len))
+		return NULL;
+	return (const char *) st->buf + (res->off - st->base);
+}
+
+void scws_stream_free(scws_stream_t st)
+{
+	const xalloc_st *a = st->s->alloc;
+
+	scws_free(st->s);
+	if (st->buf != NULL)
+		xfree_a(a, st->buf);
+	xfree_a(a, st);
+}
+
+/* incremental re-segment after an edit of the text.
+ * whitespace always ends a chunk, and the text from a whitespace on is segmented alone,
+ * so only the chunks between the last whitespace before the edit and the first one after
+ * it (where a new chunk ends) are segmented again, the rest nodes are kept or shifted */
+scws_res_t scws_resegment(scws_t s, scws_res_t res, const char *text, int len, int off, int dellen, int inslen)
+{
+	scws_res_t head, tail, cur, prev, rest;
+	int start, end, delta;
+
+	if (!s || !text || off < 0 || dellen < 0 || inslen < 0 || (off + inslen) > len)
+		return res;
+
+	/* the restart point: end of the last word followed by a whitespace before the edit,
+	 * keep the nodes before it (the chain is in chunk order) */
+	start = 0;
+	head = tail = NULL;
+	for (cur = res; cur != NULL && cur->off < off; cur = cur->next)
+	{
+		end = cur->off + ((struct scws_result_ex *) cur)->len;
+		if (end < off && end > start && (unsigned char) text[end] <= 0x20)
+			start = end;
+		if (cur->off < start)
+			tail = cur;
+	}
+	if (tail != NULL)
+	{
+		head = res;
+		res = tail->next;
+		tail->next = NULL;
+	}
+
+	/* segment the new text from the restart point, until a chunk after the edit ends
+	 * at a whitespace (the same one in the old text) */
+	scws_send_text(s, text, len);
+	s->off = _scws_xc_txt_off(s, start);
+	end = off + inslen;
+	while ((cur = scws_get_result(s)) != NULL)
+	{
+		if (tail == NULL)
+			head = cur;
+		else
+			tail->next = cur;
+		tail = s->res1;
+		if (s->off < s->len && SCWS_SRC_OFF(s, s->off) >= end && s->txt[s->off] <= 0x20)
+			break;
+	}
+
+	/* drop the old nodes before it, shift the rest */
+	delta = inslen - dellen;
+	if (cur == NULL)
+		end = len - delta;
+	else
+		end = SCWS_SRC_OFF(s, s->off) - delta;
+	for (prev = NULL, rest = res; rest != NULL && rest->off < end; prev = rest, rest = rest->next);
+	if (prev != NULL)
+	{
+		prev->next = NULL;
+		scws_free_result(res);
+	}
+	for (cur = rest; cur != NULL; cur = cur->next)
+		cur->off += delta;
+
+	if (tail == NULL)
+		head = rest;
+	else
+		tail->next = rest;
+
+	s->off = s->len;
+	return head;
+}
+
+/* top words count */
+// xattr = ~v,p,c
+// xattr = v,pn,c
+
+/* the attrs of xattr as a bitset of the codes attr[0] | attr[1] << 8 */
+typedef struct
+{
+	unsigned int bits[0x10000 >> 5];
+}	word_attr;
+
+#define	SCWS_ATTR_CODE(a)		((unsigned char) (a)[0] | ((a)[0] ? ((unsigned char) (a)[1] << 8) : 0))
+#define	_attr_belong(a,at)		((at)->bits[SCWS_ATTR_CODE(a) >> 5] & (1U << (SCWS_ATTR_CODE(a) & 0x1f)))
+
+/* parse xattr into at, return NULL if no filter */
+static word_attr *_attr_parse(const char *xattr, int *xmode, word_attr *at)
+{
+	const char *word;
+	char a[3];
+
+	if (xattr == NULL)
+		return NULL;
+	if (*xattr == '~')
+	{
+		xattr++;
+		*xmode = SCWS_YEA;
+	}
+	if (*xattr == '\0')
+		return NULL;
+
+	memset(at, 0, sizeof(word_attr));
+	while (1)
+	{
+		a[0] = *xattr;
+		a[1] = a[2] = '\0';
+		if ((word = strchr(xattr, ',')) == NULL)
+		{
+			if (a[0] != '\0')
+				a[1] = xattr[1];
+		}
+		else if (++xattr != word)
+			a[1] = *xattr;
+		if (a[0] != '\0')
+			at->bits[SCWS_ATTR_CODE(a) >> 5] |= 1U << (SCWS_ATTR_CODE(a) & 0x1f);
+		if (word == NULL)
+			break;
+		xattr = word + 1;
+	}
+	return at;
+}
+
+/* segment one more chunk of the text into s->tok, return 0 at the end.
+ * a short text keeps all its tokens, a long one only keeps the last chunk */
+static int _scws_token_more(scws_t s)
+{
+	struct scws_token *tk;
+	scws_res_t res, cur;
+	int off, degraded;
+
+	if (s->tok_off >= s->len)
+		return 0;
+
+	// save the offset (a chunk is counted as degraded once, by scws_get_result)
+	off = s->off;
+	degraded = s->degraded;
+	s->off = s->tok_off;
+	res = scws_get_result(s);
+	s->tok_off = (res == NULL ? s->len : s->off);
+	s->off = off;
+	s->degraded = degraded;
+	if (res == NULL)
+		return 0;
+
+	if (s->len > SCWS_TOK_KEEP_MAX)
+	{
+		s->tok_base += s->tok_num;
+		s->tok_num = 0;
+	}
+	for (cur = res; cur != NULL; cur = cur->next)
+	{
+		if (s->tok_num == s->tok_size)
+		{
+			s->tok_size = (s->tok_size == 0 ? 256 : s->tok_size << 1);
+			s->tok = (struct scws_token *) xrealloc_a(s->alloc, s->tok, sizeof(struct scws_token) * s->tok_size);
+		}
+		tk = &s->tok[s->tok_num++];
+		tk->off = cur->off;
+		tk->idf = cur->idf;
+		tk->len = ((struct scws_result_ex *) cur)->len;
+		memcpy(tk->attr, cur->attr, 3);
+		tk->view = ((struct scws_result_ex *) cur)->view;
+		tk->id = cur->id;
+	}
+	scws_free_result(res);
+	return 1;
+}
+
+/* the i-th token of the current text (segmented on demand), NULL at the end */
+static struct scws_token *_scws_token(scws_t s, int i)
+{
+	// the dropped tokens of a long text, start over
+	if (i < s->tok_base)
+		SCWS_TOK_RESET(s);
+
+	while ((i - s->tok_base) >= s->tok_num)
+	{
+		if (!_scws_token_more(s))
+			return NULL;
+	}
+	return &s->tok[i - s->tok_base];
+}
+
+/* count the words of current text into the stats, return the number of counted words */
+static int _scws_stat_text(scws_t s, xstat_t st, const char *xattr)
+{
+	int i, cnt, xmode = SCWS_NA;
+	struct scws_token *cur;
+	char *word, lower[SCWS_MAX_EWLEN+1];
+	word_attr xat, *at;
+
+	at = _attr_parse(xattr, &xmode, &xat);
+
+	for (i = cnt = 0; (cur = _scws_token(s, i)) != NULL; i++)
+	{
+		if (cur->idf < 0.2 || cur->attr[0] == '#')
+			continue;
+
+		/* check attribute filter */
+		if (at != NULL)
+		{
+			if ((xmode == SCWS_NA) && !_attr_belong(cur->attr, at))
+				continue;
+
+			if ((xmode == SCWS_YEA) && _attr_belong(cur->attr, at))
+				continue;
+		}
+
+		/* check stopwords */
+		if (!strncmp(cur->attr, attr_en, 2) && cur->len > 6)
+		{
+			word = (cur->len <= SCWS_MAX_EWLEN ? lower : (char *) xmalloc_a(s->alloc, cur->len + 1));
+			memcpy(word, SCWS_SRC(s) + cur->off, cur->len);
+			word[cur->len] = '\0';
+			_str_tolower(word, word);
+			if (SCWS_IS_NOSTATS(word, cur->len))
 			{
-				top->weight += cur->idf;
-				top->times++;
+				if (word != lower)
+					xfree_a(s->alloc, word);
+				continue;
 			}
+			if (word != lower)
+				xfree_a(s->alloc, word);
 		}
-		while ((cur = cur->next) != NULL);
-		scws_free_result(res);
+
+		/* put to the stats */
+		xstat_add(st, (char *) SCWS_SRC(s) + cur->off, cur->len, cur->attr, cur->idf, 1);
+		cnt++;
 	}
+	return cnt;
+}
 
-	// free at
-	if (at != NULL)
-		free(at);
-	top = NULL;
-	if (cnt > 0)
-	{
-		/* sort the list */
-		list = (scws_top_t *) malloc(sizeof(scws_top_t) * cnt);
-		_tops_load_all(xt, list);
-		qsort(list, cnt, sizeof(scws_top_t), _tops_cmp);
-
-		/* save to return pointer */
-		if (!limit || limit > cnt)
-			limit = cnt;
-		
-		top = tail = (scws_top_t) malloc(sizeof(struct scws_topword));
-		memcpy(top, list[0], sizeof(struct scws_topword));
-		top->word = strdup(list[0]->word);
-		top->next = NULL;
+int scws_stat_add(scws_t s, xstat_t st, const char *xattr)
+{
+	if (!s || !s->txt || !st)
+		return 0;
+	return _scws_stat_text(s, st, xattr);
+}
 
-		for (cnt = 1; cnt < limit; cnt++)
+/* a string of a top word */
+static char *_scws_strdup_a(const xalloc_st *a, const char *str, int len)
+{
+	char *dst;
+
+	dst = (char *) xmalloc_a(a, len + 1);
+	memcpy(dst, str, len);
+	dst[len] = '\0';
+	return dst;
+}
+
+/* a top word keeps its allocator after the public part like a result node */
+struct scws_topword_ex
+{
+	struct scws_topword t;
+	const xalloc_st *alloc;
+};
+
+/* a new top word & its string (freed by scws_free_tops) */
+static scws_top_t _scws_top_new(const xalloc_st *a, const char *str, int len)
+{
+	scws_top_t top;
+
+	top = (scws_top_t) xmalloc_a(a, sizeof(struct scws_topword_ex));
+	((struct scws_topword_ex *) top)->alloc = a;
+	top->word = _scws_strdup_a(a, str, len);
+	return top;
+}
+
+static scws_top_t _scws_stat_tops(const xalloc_st *a, xstat_t st, int limit)
+{
+	struct xstat_item **list;
+	scws_top_t top, tail, base;
+	int i, n;
+
+	if (!st || st->num == 0)
+		return NULL;
+
+	if (limit <= 0 || limit > st->num)
+		limit = st->num;
+	list = (struct xstat_item **) xmalloc_a(a, sizeof(struct xstat_item *) * limit);
+	n = xstat_top(st, list, limit);
+
+	/* save to return pointer */
+	top = tail = NULL;
+	for (i = 0; i < n; i++)
+	{
+		base = _scws_top_new(a, list[i]->word, list[i]->len);
+		base->weight = list[i]->weight;
+		base->times = (list[i]->times > 0x7fff ? 0x7fff : list[i]->times);
+		memcpy(base->attr, list[i]->attr, 2);
+		base->next = NULL;
+		if (tail == NULL)
+			top = tail = base;
+		else
 		{
-			base = (scws_top_t) malloc(sizeof(struct scws_topword));
-			memcpy(base, list[cnt], sizeof(struct scws_topword));
-			base->word = strdup(list[cnt]->word);
-			base->next = NULL;
 			tail->next = base;
 			tail = base;
 		}
-		free(list);
 	}
+	xfree_a(a, list);
+	return top;
+}
 
-	// restore the offset
-	s->off = off;
-	xtree_free(xt);	
+scws_top_t scws_stat_tops(xstat_t st, int limit)
+{
+	return _scws_stat_tops(NULL, st, limit);
+}
+
+scws_top_t scws_get_tops(scws_t s, int limit, const char *xattr)
+{
+	xstat_t st;
+	scws_top_t top;
+
+	if (!s || !s->txt || !(st = xstat_new(0)))
+		return NULL;
+
+	_scws_stat_text(s, st, xattr);
+	top = _scws_stat_tops(s->alloc, st, limit);
+	xstat_free(st);
 	return top;
 }
 
-// word check by attr.
+// word check by attr, stop at the first matched word.
 int scws_has_word(scws_t s, const char *xattr)
 {
-	int off, cnt, xmode = SCWS_NA;
-	scws_res_t res, cur;
-	char *word;
-	word_attr *at = NULL;	
+	int i, cnt, xmode = SCWS_NA;
+	struct scws_token *cur;
+	word_attr xat, *at;
 
 	if (!s || !s->txt)
 		return 0;
 
-	__PARSE_XATTR__;
+	at = _attr_parse(xattr, &xmode, &xat);
 
-	// save the offset. (cnt -> return_value)
-	off = s->off;
-	cnt = s->off = 0;
-	while (!cnt && (cur = res = scws_get_result(s)) != NULL)
+	// cnt -> return_value
+	cnt = 0;
+	if (at != NULL)
 	{
-		do
+		for (i = 0; !cnt && (cur = _scws_token(s, i)) != NULL; i++)
 		{
 			/* check attribute filter */
-			if (at != NULL)
-			{
-				if ((xmode == SCWS_NA) && _attr_belong(cur->attr, at))
-					cnt = 1;
+			if ((xmode == SCWS_NA) && _attr_belong(cur->attr, at))
+				cnt = 1;
 
-				if ((xmode == SCWS_YEA) && !_attr_belong(cur->attr, at))
-					cnt = 1;
-			}		
+			if ((xmode == SCWS_YEA) && !_attr_belong(cur->attr, at))
+				cnt = 1;
 		}
-		while (!cnt && (cur = cur->next) != NULL);
-		scws_free_result(res);
 	}
-	// memory leak fixed, thanks to lauxinz
-	if (at != NULL)
-		free(at);
-	s->off = off;
 	return cnt;
 }
 
 // get words by attr (rand order)
 scws_top_t scws_get_words(scws_t s, const char *xattr)
 {
-	int off, cnt, xmode = SCWS_NA;
-	xtree_t xt;	
-	scws_res_t res, cur;
+	int i, xmode = SCWS_NA;
+	struct scws_token *cur;
+	xstat_t st;
 	scws_top_t top, tail, base;
-	char *word;
-	word_attr *at = NULL;
+	word_attr xat, *at;
 
-	if (!s || !s->txt || !(xt = xtree_new(0,1)))
+	if (!s || !s->txt || !(st = xstat_new(0)))
 		return NULL;
 
-	__PARSE_XATTR__;
+	at = _attr_parse(xattr, &xmode, &xat);
 
-	// save the offset.
-	off = s->off;
-	s->off = 0;
-	base = tail = NULL;
-	while ((cur = res = scws_get_result(s)) != NULL)
+	for (i = 0; (cur = _scws_token(s, i)) != NULL; i++)
 	{
-		do
+		/* check attribute filter */
+		if (at != NULL)
 		{
-			/* check attribute filter */
-			if (at != NULL)
-			{
-				if ((xmode == SCWS_NA) && !_attr_belong(cur->attr, at))
-					continue;
+			if ((xmode == SCWS_NA) && !_attr_belong(cur->attr, at))
+				continue;
 
-				if ((xmode == SCWS_YEA) && _attr_belong(cur->attr, at))
-					continue;
-			}
+			if ((xmode == SCWS_YEA) && _attr_belong(cur->attr, at))
+				continue;
+		}
 
-			/* put to the stats */
-			if (!(top = xtree_nget(xt, s->txt + cur->off, cur->len, NULL)))
-			{
-				top = (scws_top_t) malloc(sizeof(struct scws_topword));
-				top->weight = cur->idf;
-				top->times = 1;
-				top->next = NULL;
-				top->word = (char *)_mem_ndup(s->txt + cur->off, cur->len);
-				strncpy(top->attr, cur->attr, 2);
-				// add to the chain
-				if (tail == NULL)
-					base = tail = top;
-				else
-				{
-					tail->next = top;
-					tail = top;
-				}
-				xtree_nput(xt, top, sizeof(struct scws_topword), s->txt + cur->off, cur->len);
-			}
-			else
-			{
-				top->weight += cur->idf;
-				top->times++;
-			}
+		/* put to the stats */
+		xstat_add(st, (char *) SCWS_SRC(s) + cur->off, cur->len, cur->attr, cur->idf, 1);
+	}
+
+	// the items keep the order of first appearance
+	base = tail = NULL;
+	for (i = 0; i < st->num; i++)
+	{
+		top = _scws_top_new(s->alloc, st->items[i].word, st->items[i].len);
+		top->weight = st->items[i].weight;
+		top->times = (st->items[i].times > 0x7fff ? 0x7fff : st->items[i].times);
+		memcpy(top->attr, st->items[i].attr, 2);
+		top->next = NULL;
+		// add to the chain
+		if (tail == NULL)
+			base = tail = top;
+		else
+		{
+			tail->next = top;
+			tail = top;
 		}
-		while ((cur = cur->next) != NULL);
-		scws_free_result(res);
 	}
 
-	// free at & xtree
-	if (at != NULL)
-		free(at);
-	xtree_free(xt);
+	// free stats
+	xstat_free(st);
 
-	// restore the offset
-	s->off = off;
 	return base;
 }
 
@@ -1571,7 +3205,183 @@ void scws_free_tops(scws_top_t tops)
 	{
 		tops = cur->next;
 		if (cur->word)
-			free(cur->word);			
-		free(cur);
+			xfree_a(((struct scws_topword_ex *) cur)->alloc, cur->word);
+		xfree_a(((struct scws_topword_ex *) cur)->alloc, cur);
+	}
+}
+
+/* fnv-1a of the bytes with bit 31 set, never collides with a dict id */
+unsigned int scws_hash_id(const char *word, int len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len-- > 0)
+	{
+		h ^= (unsigned char) *word++;
+		h *= 16777619U;
 	}
+	return (h & ~SCWS_WORD_ID_HASHED) | SCWS_WORD_ID_HASHED;
+}
+
+#define	_BAG_SLOT(id,bits)	(((id) * 2654435761U) >> (32 - (bits)))
+
+// bag of words by ids (the order of first appearance), open addressing on the ids
+scws_bag_t scws_get_bag(scws_t s, const char *xattr)
+{
+	int i, j, num, size, bits, total, xmode = SCWS_NA;
+	int *slot;
+	struct scws_token *cur;
+	struct scws_bagword *list;
+	scws_bag_t bag;
+	word_attr xat, *at;
+
+	if (!s || !s->txt)
+		return NULL;
+
+	at = _attr_parse(xattr, &xmode, &xat);
+
+	num = total = 0;
+	bits = 8;
+	size = 1 << (bits - 1);
+	list = (struct scws_bagword *) xmalloc_a(s->alloc, sizeof(struct scws_bagword) * size);
+	slot = (int *) xmalloc_a(s->alloc, sizeof(int) << bits);
+	if (list == NULL || slot == NULL)
+		goto bag_fail;
+	memset(slot, -1, sizeof(int) << bits);
+
+	for (i = 0; (cur = _scws_token(s, i)) != NULL; i++)
+	{
+		/* check attribute filter */
+		if (at != NULL)
+		{
+			if ((xmode == SCWS_NA) && !_attr_belong(cur->attr, at))
+				continue;
+
+			if ((xmode == SCWS_YEA) && _attr_belong(cur->attr, at))
+				continue;
+		}
+
+		total++;
+		for (j = _BAG_SLOT(cur->id, bits); slot[j] >= 0; j = (j + 1) & ((1 << bits) - 1))
+		{
+			if (list[slot[j]].id == cur->id)
+				break;
+		}
+		if (slot[j] >= 0)
+		{
+			list[slot[j]].count++;
+			continue;
+		}
+
+		list[num].id = cur->id;
+		list[num].count = 1;
+		slot[j] = num++;
+
+		// keep the load under 1/2, rebuild the slots
+		if (num == size)
+		{
+			struct scws_bagword *tmp;
+
+			if ((tmp = (struct scws_bagword *) xrealloc_a(s->alloc, list, sizeof(struct scws_bagword) * (size << 1))) == NULL)
+				goto bag_fail;
+			list = tmp;
+			xfree_a(s->alloc, slot);
+			if ((slot = (int *) xmalloc_a(s->alloc, sizeof(int) << (bits + 1))) == NULL)
+				goto bag_fail;
+			size <<= 1;
+			bits++;
+			memset(slot, -1, sizeof(int) << bits);
+			for (j = 0; j < num; j++)
+			{
+				int k = _BAG_SLOT(list[j].id, bits);
+				while (slot[k] >= 0)
+					k = (k + 1) & ((1 << bits) - 1);
+				slot[k] = j;
+			}
+		}
+	}
+	xfree_a(s->alloc, slot);
+	slot = NULL;
+
+	// one block for the caller
+	if ((bag = (scws_bag_t) xmalloc_o(s->alloc, sizeof(struct scws_bag) + sizeof(struct scws_bagword) * num)) == NULL)
+		goto bag_fail;
+	bag->num = num;
+	bag->total = total;
+	bag->words = (struct scws_bagword *) (bag + 1);
+	if (num > 0)
+		memcpy(bag->words, list, sizeof(struct scws_bagword) * num);
+	xfree_a(s->alloc, list);
+
+	return bag;
+
+bag_fail:
+	if (slot != NULL)
+		xfree_a(s->alloc, slot);
+	if (list != NULL)
+		xfree_a(s->alloc, list);
+	return NULL;
+}
+
+void scws_free_bag(scws_bag_t bag)
+{
+	if (bag != NULL)
+		xfree_o(bag);
+}
+
+#define	_TOK_NEWLINE(txt,o,l)	((l) == 1 && ((txt)[(o)] == '\n' || (txt)[(o)] == '\r'))
+
+int scws_tok_add(scws_t s, xtok_writer_t w)
+{
+	struct scws_token *cur;
+	int i, cnt;
+
+	if (!s || !s->txt || !w)
+		return 0;
+
+	xtok_doc_begin(w, (const char *) SCWS_SRC(s), SCWS_SRC_LEN(s));
+	for (i = cnt = 0; (cur = _scws_token(s, i)) != NULL; i++)
+	{
+		if (_TOK_NEWLINE(SCWS_SRC(s), cur->off, cur->len))
+			continue;
+		xtok_put(w, cur->off, cur->len, cur->attr, cur->idf, cur->id);
+		cnt++;
+	}
+	xtok_doc_end(w);
+	return cnt;
+}
+
+/* write a chain, the full lengths are in wlen (one by one) or in the node tails (wlen = NULL) */
+static int _scws_tok_chain(xtok_writer_t w, const char *text, int len, scws_res_t res, const unsigned int *wlen)
+{
+	int cnt;
+
+	xtok_doc_begin(w, text, len);
+	for (cnt = 0; res != NULL; res = res->next)
+	{
+		len = (wlen == NULL ? ((struct scws_result_ex *) res)->len : *wlen++);
+		if (_TOK_NEWLINE(text, res->off, len))
+			continue;
+		xtok_put(w, res->off, len, res->attr, res->idf, res->id);
+		cnt++;
+	}
+	xtok_doc_end(w);
+	return cnt;
+}
+
+int scws_tok_add_res(xtok_writer_t w, const char *text, int len, scws_res_t res)
+{
+	if (!w)
+		return 0;
+	return _scws_tok_chain(w, text, len, res, NULL);
+}
+
+int scws_tok_add_batch(xtok_writer_t w, scws_batch_t b, int i, const char *text, int len)
+{
+	int k;
+
+	if (!w || !b || i < 0 || i >= b->num)
+		return 0;
+	k = b->index[i];
+	return _scws_tok_chain(w, text, len, (k < b->index[i+1] ? &b->res[k] : NULL), b->len + k);
 }
@@ -15,6 +15,9 @@ extern "C" {
 #include "version.h"
 #include "rule.h"
 #include "xdict.h"
+#include "xstat.h"
+#include "xtok.h"
+#include "xalloc.h"
 
 #define	SCWS_IGN_SYMBOL		0x01
 //#define	SCWS_SEG_MULTI		0x02
@@ -22,6 +25,12 @@ extern "C" {
 #define	SCWS_DEBUG			0x08
 #define	SCWS_DUALITY		0x10
 
+/* greedy segment policy: maximum matching, skip the path scoring (faster, less accurate) */
+#define	SCWS_GREEDY_NONE	0x00
+#define	SCWS_GREEDY_FORWARD	0x20		// forward maximum matching
+#define	SCWS_GREEDY_BACKWARD	0x40	// backward maximum matching
+#define	SCWS_GREEDY_MASK	0x60
+
 /* hightman.070901: multi segment policy */
 #define SCWS_MULTI_NONE     0x00000		// nothing
 #define	SCWS_MULTI_SHORT	0x01000		// split long words to short words from left to right
@@ -30,6 +39,13 @@ extern "C" {
 #define	SCWS_MULTI_ZALL		0x08000		// attr = ** , all split to single chars
 #define	SCWS_MULTI_MASK		0xff000		// mask check for multi set
 
+/* view of a result in the multi mode (see scws_res_view), one bit per SCWS_MULTI_xxx */
+#define	SCWS_VIEW_BASE		0x00		// the words without multi mode
+#define	SCWS_VIEW_SHORT		(SCWS_MULTI_SHORT >> 12)
+#define	SCWS_VIEW_DUALITY	(SCWS_MULTI_DUALITY >> 12)
+#define	SCWS_VIEW_ZMAIN		(SCWS_MULTI_ZMAIN >> 12)
+#define	SCWS_VIEW_ZALL		(SCWS_MULTI_ZALL >> 12)
+
 #define	SCWS_ZIS_USED		0x8000000
 
 #define	SCWS_YEA			(1)
@@ -44,9 +60,24 @@ struct scws_result
 	float idf;
 	unsigned char len;
 	char attr[3];
+	unsigned int id;	/* id of the dict entry, or hashed (see scws_hash_id) */
 	scws_res_t next;
 };
 
+/* result for huge text (see scws_send_text64), 64-bit offset & 32-bit length */
+typedef struct scws_result64 *scws_res64_t;
+
+struct scws_result64
+{
+	size_t off;
+	float idf;
+	unsigned int len;
+	char attr[3];
+	unsigned char view;	/* see scws_res_view */
+	unsigned int id;
+	scws_res64_t next;
+};
+
 typedef struct scws_topword *scws_top_t;
 
 struct scws_topword
@@ -58,14 +89,65 @@ struct scws_topword
 	scws_top_t next;
 };
 
+/* bag of words: (id, count) of the tokens of a doc in the order of first appearance */
+struct scws_bagword
+{
+	unsigned int id;
+	int count;
+};
+
+typedef struct scws_bag *scws_bag_t;
+
+struct scws_bag
+{
+	int num;
+	int total;			/* tokens counted */
+	struct scws_bagword *words;
+};
+
+/* batch result: doc i owns res[index[i]] ~ res[index[i+1]-1], linked by next as a normal chain,
+ * view[k] is the view of res[k] (scws_res_view does not work on these copies) */
+typedef struct scws_batch *scws_batch_t;
+
+struct scws_batch
+{
+	int num;
+	int total;
+	int *index;
+	struct scws_result *res;
+	unsigned char *view;
+	unsigned int *len;		/* full length of res[k] (res[k].len is only 8 bits) */
+};
+
+/* lattice row bitmask: one bit per char column, SCWS_MAX_ZLEN(128) bits */
+#define	SCWS_ZMASK_WORDS	2
+
 struct scws_zchar
 {
 	int start;
 	int end;
+	unsigned long long full[SCWS_ZMASK_WORDS];	// bit k: wmap[i][k] is a FULL word
+	unsigned long long part[SCWS_ZMASK_WORDS];	// bit k: wmap[i][k] has a longer word after it
 };
 
 typedef struct scws_st scws_st, *scws_t;
 
+/* shared engine: dict, rules, charset & mode, immutable once created (see scws_engine_new) */
+typedef struct scws_engine scws_engine_st, *scws_engine_t;
+
+struct scws_engine
+{
+	xdict_t d;
+	rule_t r;
+	unsigned char *mblen;
+	unsigned int mode;
+	int (*scan)(struct scws_st *s, int *zlen, int *pflag, int *rend);
+	int budget;
+	const xalloc_st *alloc;
+	int ref;		/* atomic refcount, one per context */
+};
+
+/* the scws_t is the per-call context (text, offset, results & work maps) */
 struct scws_st
 {
 	xdict_t d;
@@ -81,6 +163,42 @@ struct scws_st
 	scws_res_t res1;
 	word_t **wmap;
 	struct scws_zchar *zmap;
+	int (*scan)(struct scws_st *s, int *zlen, int *pflag, int *rend);	/* chunk scanner of the charset */
+	size_t xbase;	/* offset of txt in the whole text (scws_send_text64) */
+	size_t xlen;
+	struct scws_token *tok;	/* segmented tokens of txt, shared by get_tops/get_words/has_word */
+	int tok_num;
+	int tok_size;
+	int tok_base;	/* index of tok[0], not 0 when the text is too long to keep all */
+	int tok_off;	/* txt is segmented into tok up to here */
+	scws_engine_t e;	/* not NULL: d & r are borrowed from this engine */
+	int budget;		/* work units of path scoring per chunk, 0: unlimited */
+	int work;		/* work units used by the current chunk, -1: over the budget */
+	int degraded;	/* chunks fallen back to greedy since scws_send_text */
+	struct scws_cache *cache;	/* results of the repeated chunks, see scws_set_cache */
+	unsigned char *fmap;	/* text of scws_send_file/fd (offsets are from here), released by the next send */
+	size_t fmap_len;
+	int fmap_type;	/* 1: mmap, 2: malloc (not mappable) */
+	pool_t pool;	/* lattice memory of a chunk, reset (not freed) for the next one */
+	const xalloc_st *alloc;	/* context memory & results, NULL: the global one (see xalloc.h) */
+	int view;		/* view of the results being put, see scws_res_view */
+	struct scws_xcode *xc;	/* input charset conversion, see scws_set_input_charset */
+};
+
+/* push-based streaming input, see scws_stream_new() */
+typedef struct scws_stream scws_stream_st, *scws_stream_t;
+
+struct scws_stream
+{
+	scws_t s;			/* forked engine */
+	unsigned char *buf;	/* pending text */
+	int size;
+	int len;
+	int off;			/* segmented up to here */
+	int cut;			/* segmentable up to here */
+	int scan;			/* chars scanned up to here */
+	size_t base;		/* absolute offset of buf[0] */
+	int eof;
 };
 
 /* api: init the scws handler */
@@ -89,10 +207,19 @@ void scws_free(scws_t s);
 /* fork instance for multi-threaded usage, but they shared the dict/rules */
 scws_t scws_fork(scws_t s);
 
+/* shared engine: a snapshot of the settings of s, each thread makes its own context of it */
+scws_engine_t scws_engine_new(scws_t s);
+scws_t scws_engine_ctx(scws_engine_t e);
+void scws_engine_free(scws_engine_t e);
+
 /* mode = SCWS_XDICT_XDB | SCWS_XDICT_MEM | SCWS_XDICT_TXT */
 int scws_add_dict(scws_t s, const char *fpath, int mode);
 int scws_set_dict(scws_t s, const char *fpath, int mode);
 void scws_set_charset(scws_t s, const char *cs);
+
+/* the text sent is in cs (gbk, big5), converted to the utf-8 of s, offsets are of the text sent.
+ * set it after the charset, cs = NULL: no conversion. return -1 if not convertible */
+int scws_set_input_charset(scws_t s, const char *cs);
 void scws_set_rule(scws_t s, const char *fpath);
 
 /* set ignore symbol or multi segments */
@@ -100,17 +227,82 @@ void scws_set_ignore(scws_t s, int yes);
 void scws_set_multi(scws_t s, int mode);
 void scws_set_debug(scws_t s, int yes);
 void scws_set_duality(scws_t s, int yes);
+void scws_set_greedy(scws_t s, int mode);
+
+/* latency budget: units of path scoring per chunk before going greedy (0: unlimited) */
+void scws_set_budget(scws_t s, int units);
+int scws_get_degraded(scws_t s);
+
+/* allocator hooks (see xalloc.h), s = NULL: the global one, else the one of the context
+ * memory & the results, set it before sending the text. a must outlive them all */
+void scws_set_allocator(scws_t s, const xalloc_st *a);
+
+/* cache the results of at most size multi-byte chunks for the repeated text (0: disable) */
+void scws_set_cache(scws_t s, int size);
+void scws_get_cache_stats(scws_t s, unsigned long *hits, unsigned long *misses);
 
 void scws_send_text(scws_t s, const char *text, int len);
 scws_res_t scws_get_result(scws_t s);
 void scws_free_result(scws_res_t result);
 
+/* view of a result node in the multi mode: SCWS_VIEW_BASE or the expansion made it,
+ * only for the nodes of scws_get_result & co. (see scws_batch.view & scws_result64.view) */
+int scws_res_view(scws_res_t res);
+
+/* segment all the rest text on multi threads (threads <= 0: all cpus), result in text order */
+scws_res_t scws_get_result_mt(scws_t s, int threads);
+
+/* 64-bit variant for the text over 2GB */
+void scws_send_text64(scws_t s, const char *text, size_t len);
+scws_res64_t scws_get_result64(scws_t s);
+void scws_free_result64(scws_res64_t result);
+
+/* map (or read) the whole file & send it, kept as s->fmap till the next send, return 0 on success */
+int scws_send_file(scws_t s, const char *fpath);
+int scws_send_fd(scws_t s, int fd);
+
+/* segment many docs on multi threads (lens=NULL: strlen), return NULL if out of memory */
+scws_batch_t scws_segment_batch(scws_t s, const char **docs, const int *lens, int num, int threads);
+void scws_free_batch(scws_batch_t b);
+
+/* streaming: push chunks of any size, results carry absolute offsets (64-bit over 2GB) */
+scws_stream_t scws_stream_new(scws_t s);
+void scws_stream_push(scws_stream_t st, const char *data, int len);
+void scws_stream_end(scws_stream_t st);
+scws_res_t scws_stream_get_result(scws_stream_t st);
+scws_res64_t scws_stream_get_result64(scws_stream_t st);
+/* word text of a result, valid until next scws_stream_push() */
+const char *scws_stream_word(scws_stream_t st, scws_res_t res);
+const char *scws_stream_word64(scws_stream_t st, scws_res64_t res);
+void scws_stream_free(scws_stream_t st);
+
+/* incremental: re-segment the chunks touched by an edit (dellen bytes at off replaced by inslen),
+ * res of the old text is reused or freed, return the result of the new text */
+scws_res_t scws_resegment(scws_t s, scws_res_t res, const char *text, int len, int off, int dellen, int inslen);
+
 scws_top_t scws_get_tops(scws_t s, int limit, const char *xattr);
+
+/* corpus-level stats: count the current text of s into st (see xstat.h), get tops from st */
+int scws_stat_add(scws_t s, xstat_t st, const char *xattr);
+scws_top_t scws_stat_tops(xstat_t st, int limit);
 void scws_free_tops(scws_top_t tops);
 
 scws_top_t scws_get_words(scws_t s, const char *xattr);
 int scws_has_word(scws_t s, const char *xattr);
 
+/* word id of the words not in the dict: fnv-1a of the bytes with SCWS_WORD_ID_HASHED set */
+unsigned int scws_hash_id(const char *word, int len);
+
+/* bag of words of the current text by ids, return NULL if out of memory */
+scws_bag_t scws_get_bag(scws_t s, const char *xattr);
+void scws_free_bag(scws_bag_t b);
+
+/* binary token stream (see xtok.h): add the text of s, a result chain or doc i of a batch
+ * as one doc, return the number of tokens */
+int scws_tok_add(scws_t s, xtok_writer_t w);
+int scws_tok_add_res(xtok_writer_t w, const char *text, int len, scws_res_t res);
+int scws_tok_add_batch(xtok_writer_t w, scws_batch_t b, int i, const char *text, int len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,145 @@
+/**
+ * @file xalloc.c (pluggable allocator: a global one & the optional one of each scws context)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "xalloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void *_xalloc_malloc(void *ctx, size_t size)
+{
+	return malloc(size);
+}
+
+static void *_xalloc_realloc(void *ctx, void *ptr, size_t size)
+{
+	return realloc(ptr, size);
+}
+
+static void _xalloc_free(void *ctx, void *ptr)
+{
+	free(ptr);
+}
+
+static xalloc_st _xalloc = { _xalloc_malloc, _xalloc_realloc, _xalloc_free, NULL };
+
+/* head of the caller's memory, aligned for any member of the public structs */
+union xalloc_head
+{
+	const xalloc_st *a;
+	double d;
+	long long l;
+};
+
+void xalloc_set(const xalloc_st *a)
+{
+	if (a == NULL)
+	{
+		_xalloc.malloc = _xalloc_malloc;
+		_xalloc.realloc = _xalloc_realloc;
+		_xalloc.free = _xalloc_free;
+		_xalloc.ctx = NULL;
+	}
+	else
+		_xalloc = *a;
+}
+
+void *xmalloc(size_t size)
+{
+	return _xalloc.malloc(_xalloc.ctx, size);
+}
+
+void *xcalloc(size_t num, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && num > ((size_t) -1) / size)
+		return NULL;
+	if ((ptr = _xalloc.malloc(_xalloc.ctx, num * size)) != NULL)
+		memset(ptr, 0, num * size);
+	return ptr;
+}
+
+void *xrealloc(void *ptr, size_t size)
+{
+	return _xalloc.realloc(_xalloc.ctx, ptr, size);
+}
+
+void xfree(void *ptr)
+{
+	if (ptr != NULL)
+		_xalloc.free(_xalloc.ctx, ptr);
+}
+
+char *xstrdup(const char *s)
+{
+	char *dst;
+	size_t len;
+
+	len = strlen(s) + 1;
+	if ((dst = (char *) xmalloc(len)) != NULL)
+		memcpy(dst, s, len);
+	return dst;
+}
+
+void *xmalloc_a(const xalloc_st *a, size_t size)
+{
+	if (a == NULL)
+		a = &_xalloc;
+	return a->malloc(a->ctx, size);
+}
+
+void *xrealloc_a(const xalloc_st *a, void *ptr, size_t size)
+{
+	if (a == NULL)
+		a = &_xalloc;
+	return a->realloc(a->ctx, ptr, size);
+}
+
+void xfree_a(const xalloc_st *a, void *ptr)
+{
+	if (a == NULL)
+		a = &_xalloc;
+	if (ptr != NULL)
+		a->free(a->ctx, ptr);
+}
+
+void *xmalloc_o(const xalloc_st *a, size_t size)
+{
+	union xalloc_head *h;
+
+	if ((h = (union xalloc_head *) xmalloc_a(a, sizeof(union xalloc_head) + size)) == NULL)
+		return NULL;
+	h->a = a;
+	return (void *) (h + 1);
+}
+
+void *xrealloc_o(void *ptr, size_t size)
+{
+	union xalloc_head *h;
+
+	if (ptr == NULL)
+		return xmalloc_o(NULL, size);
+	h = (union xalloc_head *) ptr - 1;
+	if ((h = (union xalloc_head *) xrealloc_a(h->a, h, sizeof(union xalloc_head) + size)) == NULL)
+		return NULL;
+	return (void *) (h + 1);
+}
+
+void xfree_o(void *ptr)
+{
+	union xalloc_head *h;
+
+	if (ptr != NULL)
+	{
+		h = (union xalloc_head *) ptr - 1;
+		xfree_a(h->a, h);
+	}
+}
@@ -0,0 +1,52 @@
+/**
+ * @file xalloc.h (pluggable allocator: a global one & the optional one of each scws context)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifndef	_SCWS_XALLOC_20261018_H_
+#define	_SCWS_XALLOC_20261018_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* an allocator, ctx is passed to each call. realloc(ctx, NULL, n) must work as malloc */
+typedef struct xalloc
+{
+	void *(*malloc)(void *ctx, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t size);
+	void (*free)(void *ctx, void *ptr);
+	void *ctx;
+}	xalloc_st, *xalloc_t;
+
+/* the global allocator of the library (NULL: the libc one), it is copied.
+ * set it before anything else, the memory must be freed by the one allocated it */
+void xalloc_set(const xalloc_st *a);
+
+/* by the global allocator */
+void *xmalloc(size_t size);
+void *xcalloc(size_t num, size_t size);
+void *xrealloc(void *ptr, size_t size);
+void xfree(void *ptr);
+char *xstrdup(const char *s);
+
+/* by the allocator a (NULL: the global one), the same a must free it */
+void *xmalloc_a(const xalloc_st *a, size_t size);
+void *xrealloc_a(const xalloc_st *a, void *ptr, size_t size);
+void xfree_a(const xalloc_st *a, void *ptr);
+
+/* the memory given to the caller: a is kept before it, so xfree_o() needs no allocator.
+ * a must be valid until the memory is freed */
+void *xmalloc_o(const xalloc_st *a, size_t size);
+void *xrealloc_o(void *ptr, size_t size);
+void xfree_o(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,274 @@
+/**
+ * @file xclass.c (byte classification kernels, sse2 with scalar fallback)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "xclass.h"
+#include "xthread.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(XCLASS_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#	define	XCLASS_SSE2
+#	define	XCLASS_TARGET(x)	__attribute__((target(x)))
+#	define	_xclass_ctz(x)		__builtin_ctz(x)
+#	include <immintrin.h>
+#elif !defined(XCLASS_NO_SIMD) && defined(_MSC_VER) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define	XCLASS_SSE2
+#	define	XCLASS_TARGET(x)
+#	include <intrin.h>
+#	include <emmintrin.h>
+static __inline int _xclass_ctz(unsigned int x)
+{
+	unsigned long r;
+	_BitScanForward(&r, x);
+	return (int) r;
+}
+#endif
+
+#define	_IS_TOKEN(x)		((x)=='('||(x)==')'||(x)=='['||(x)==']'||(x)=='{'||(x)=='}'||(x)==':'||(x)=='"')
+#define	_IS_ALPHA(x)		(((x)>=65&&(x)<=90)||((x)>=97&&(x)<=122))
+#define	_IS_DIGIT(x)		((x)>=48&&(x)<=57)
+
+/* scalar kernels, also used for the tail bytes of sse2 */
+static int _ascii_run_scalar(const unsigned char *p, int len, int *alnum, int *pairs)
+{
+	int i, ch, na, flag;
+
+	for (i = flag = 0, na = -1; i < len; i++)
+	{
+		ch = p[i];
+		if (ch <= 0x20 || ch >= 0x7f || _IS_TOKEN(ch))
+			break;
+		if (na >= 0)
+			continue;
+		if (_IS_ALPHA(ch))
+		{
+			if (_IS_ALPHA(p[i-1]))
+				flag |= XCLASS_ALPHA2;
+		}
+		else if (_IS_DIGIT(ch))
+		{
+			if (_IS_DIGIT(p[i-1]))
+				flag |= XCLASS_DIGIT2;
+		}
+		else
+			na = i;
+	}
+
+	*alnum = (na < 0 ? i : na);
+	*pairs = flag;
+	return i;
+}
+
+static int _blank_run_scalar(const unsigned char *p, int len)
+{
+	int i;
+
+	for (i = 0; i < len && p[i] <= 0x20 && p[i] != 0x0a && p[i] != 0x0d; i++);
+	return i;
+}
+
+static void _toupper_scalar(unsigned char *dst, const unsigned char *src, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = (src[i] >= 'a' && src[i] <= 'z') ? (src[i] - 0x20) : src[i];
+}
+
+/* merge the masks of a block (nbit bytes): stop/alpha/digit bit i => p[i] */
+#define	XCLASS_MERGE_BLOCK(nbit, full)												\
+do {																				\
+	unsigned int valid, nal, va;													\
+	int s = (stop ? _xclass_ctz(stop) : nbit);										\
+	valid = (s == nbit ? full : ((1U << s) - 1));									\
+	if (na < 0)																		\
+	{																				\
+		va = valid;																	\
+		if ((nal = ~(amask | dmask) & valid) != 0)									\
+		{																			\
+			na = i + _xclass_ctz(nal);												\
+			va = (1U << _xclass_ctz(nal)) - 1;										\
+		}																			\
+		if (amask & ((amask << 1) | prev_a) & va)									\
+			flag |= XCLASS_ALPHA2;													\
+		if (dmask & ((dmask << 1) | prev_d) & va)									\
+			flag |= XCLASS_DIGIT2;													\
+		prev_a = (amask >> (nbit - 1)) & 1;											\
+		prev_d = (dmask >> (nbit - 1)) & 1;											\
+	}																				\
+	if (stop)																		\
+	{																				\
+		i += s;																		\
+		goto block_end;																\
+	}																				\
+} while (0)
+
+/* the tail bytes by the scalar kernel */
+#define	XCLASS_RUN_TAIL(func)														\
+do {																				\
+	if (i < len)																	\
+	{																				\
+		int k, tna, tflag;															\
+		k = func(p + i, len - i, &tna, &tflag);										\
+		if (na < 0)																	\
+		{																			\
+			flag |= tflag;															\
+			if (tna < k)															\
+				na = i + tna;														\
+		}																			\
+		i += k;																		\
+	}																				\
+block_end:																			\
+	*alnum = (na < 0 ? i : na);														\
+	*pairs = flag;																	\
+} while (0)
+
+#ifdef XCLASS_SSE2
+XCLASS_TARGET("sse2")
+static int _ascii_run_sse2(const unsigned char *p, int len, int *alnum, int *pairs)
+{
+	int i, na, flag;
+	unsigned int stop, amask, dmask, prev_a, prev_d;
+	__m128i v, t, plain, tok;
+
+	i = flag = 0;
+	na = -1;
+	prev_a = _IS_ALPHA(p[-1]) ? 1 : 0;
+	prev_d = _IS_DIGIT(p[-1]) ? 1 : 0;
+	for (; (i + 16) <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *) (p + i));
+		plain = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)), _mm_cmpgt_epi8(v, _mm_set1_epi8(0x20)));
+		tok = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('(')), _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+		tok = _mm_or_si128(tok, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+		tok = _mm_or_si128(tok, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+		tok = _mm_or_si128(tok, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+		tok = _mm_or_si128(tok, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+		tok = _mm_or_si128(tok, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+		tok = _mm_or_si128(tok, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+		stop = ~_mm_movemask_epi8(_mm_andnot_si128(tok, plain)) & 0xffff;
+		t = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		amask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(t, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(t, _mm_set1_epi8('z' + 1))));
+		dmask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+		XCLASS_MERGE_BLOCK(16, 0xffffU);
+	}
+	XCLASS_RUN_TAIL(_ascii_run_scalar);
+	return i;
+}
+
+XCLASS_TARGET("sse2")
+static int _blank_run_sse2(const unsigned char *p, int len)
+{
+	int i;
+	unsigned int m;
+	__m128i v, b;
+
+	for (i = 0; (i + 16) <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *) (p + i));
+		b = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-1)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x21)));
+		b = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x0a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x0d))), b);
+		if ((m = ~_mm_movemask_epi8(b) & 0xffff) != 0)
+			return i + _xclass_ctz(m);
+	}
+	return i + _blank_run_scalar(p + i, len - i);
+}
+
+XCLASS_TARGET("sse2")
+static void _toupper_sse2(unsigned char *dst, const unsigned char *src, int len)
+{
+	int i;
+	__m128i v, l;
+
+	for (i = 0; (i + 16) <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *) (src + i));
+		l = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_sub_epi8(v, _mm_and_si128(l, _mm_set1_epi8(0x20))));
+	}
+	_toupper_scalar(dst + i, src + i, len - i);
+}
+#endif
+
+
+/* runtime dispatch, env SCWS_XCLASS=scalar can force the scalar one (for testing).
+ * no avx2: a run never exceeds SCWS_MAX_ZLEN(128) bytes, it was slower than sse2 there */
+struct xclass_ops
+{
+	const char *name;
+	int (*ascii_run)(const unsigned char *, int, int *, int *);
+	int (*blank_run)(const unsigned char *, int);
+	void (*toupper)(unsigned char *, const unsigned char *, int);
+};
+
+static const struct xclass_ops _ops_list[] =
+{
+#ifdef XCLASS_SSE2
+	{ "sse2", _ascii_run_sse2, _blank_run_sse2, _toupper_sse2 },
+#endif
+	{ "scalar", _ascii_run_scalar, _blank_run_scalar, _toupper_scalar }
+};
+
+static void *volatile _ops = NULL;
+
+static int _xclass_cpu_ok(const char *name)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && defined(XCLASS_SSE2)
+	if (!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+static const struct xclass_ops *_xclass_ops()
+{
+	const struct xclass_ops *ops;
+	const char *force;
+	int i, n;
+
+	/* resolved once for the process, racing threads pick the same entry */
+	if ((ops = (const struct xclass_ops *) xthread_load_ptr(&_ops)) != NULL)
+		return ops;
+
+	force = getenv("SCWS_XCLASS");
+	n = sizeof(_ops_list) / sizeof(_ops_list[0]);
+	for (i = 0; i < (n - 1); i++)
+	{
+		if (force != NULL && *force && strcmp(force, _ops_list[i].name))
+			continue;
+		if (_xclass_cpu_ok(_ops_list[i].name))
+			break;
+	}
+	ops = &_ops_list[i];
+	if (!xthread_cas_ptr(&_ops, NULL, (void *) ops))
+		ops = (const struct xclass_ops *) xthread_load_ptr(&_ops);
+	return ops;
+}
+
+int xclass_ascii_run(const unsigned char *p, int len, int *alnum, int *pairs)
+{
+	return _xclass_ops()->ascii_run(p, len, alnum, pairs);
+}
+
+int xclass_blank_run(const unsigned char *p, int len)
+{
+	return _xclass_ops()->blank_run(p, len);
+}
+
+void xclass_toupper(unsigned char *dst, const unsigned char *src, int len)
+{
+	_xclass_ops()->toupper(dst, src, len);
+}
+
+const char *xclass_kernel()
+{
+	return _xclass_ops()->name;
+}
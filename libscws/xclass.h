@@ -0,0 +1,37 @@
+/**
+ * @file xclass.h (byte classification kernels, sse2 with scalar fallback)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifndef	_SCWS_XCLASS_20261018_H_
+#define	_SCWS_XCLASS_20261018_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* pairs flag of xclass_ascii_run */
+#define	XCLASS_ALPHA2		0x01	/* two adjacent alpha */
+#define	XCLASS_DIGIT2		0x02	/* two adjacent digit */
+
+/* length of the plain ascii run (0x21~0x7e, but not the token chars: ()[]{}:") at p, at most len.
+ * *alnum: length of the leading alnum part of the run,
+ * *pairs: XCLASS_ALPHA2|XCLASS_DIGIT2 found in p[-1] ~ p[*alnum-1], p[-1] must be readable */
+int xclass_ascii_run(const unsigned char *p, int len, int *alnum, int *pairs);
+
+/* length of the blank run (bytes <= 0x20, except \r \n) at p, at most len */
+int xclass_blank_run(const unsigned char *p, int len);
+
+/* convert a-z to A-Z, len bytes from src to dst */
+void xclass_toupper(unsigned char *dst, const unsigned char *src, int len);
+
+/* name of the kernels in use: "sse2" or "scalar" */
+const char *xclass_kernel();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "xdb.h"
 #include "lock.h"
+#include "xalloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,8 +51,13 @@ static void _xdb_read_data(xdb_t x, void *buf, scws_io_size_t off, scws_io_size_
 
 	if (x->fd >= 0)
 	{
+#ifdef HAVE_PREAD
+		/* no shared file offset, safe for the forked engines in threads */
+		pread(x->fd, buf, len, off);
+#else
 		lseek(x->fd, off, SEEK_SET);
 		read(x->fd, buf, len);
+#endif
 	}
 	else
 	{
@@ -102,7 +108,7 @@ static xrec_t _xdb_rec_find(xdb_t x, const char *key, int len, xrec_t rec)
 	int i;
 	
 	if (rec == NULL)
-		rec = (xrec_t) malloc(sizeof(xrec_st));
+		rec = (xrec_t) xmalloc(sizeof(xrec_st));
 
 	memset(rec, 0, sizeof(xrec_st));
 	i = (x->prime > 1 ? _xdb_hasher(x, key, len) : 0);
@@ -121,7 +127,7 @@ xdb_t xdb_open(const char *fpath, int mode)
 	struct xdb_header xhdr;
 
 	/* create the new memory */
-	if (!(x = (xdb_t ) malloc(sizeof(xdb_st))))
+	if (!(x = (xdb_t ) xmalloc(sizeof(xdb_st))))
 		return NULL;
 
 	/* try to open & check the file */
@@ -130,7 +136,7 @@ xdb_t xdb_open(const char *fpath, int mode)
 #ifdef DEBUG
 		perror("Failed to open the XDB file");
 #endif
-		free(x);
+		xfree(x);
 		return NULL;
 	}
 
@@ -141,7 +147,7 @@ xdb_t xdb_open(const char *fpath, int mode)
 		perror("Invalid XDB file");
 #endif
 		close(x->fd);
-		free(x);
+		xfree(x);
 		return NULL;
 	}
 
@@ -154,7 +160,7 @@ xdb_t xdb_open(const char *fpath, int mode)
 		perror("Invalid XDB file format");
 #endif
 		close(x->fd);
-		free(x);
+		xfree(x);
 		return NULL;
 	}
 	x->prime = xhdr.prime;
@@ -179,7 +185,7 @@ xdb_t xdb_open(const char *fpath, int mode)
 #ifdef DEBUG
 			perror("Mmap() failed");
 #endif
-			free(x);
+			xfree(x);
 			return NULL;
 		}
 	}
@@ -193,7 +199,7 @@ xdb_t xdb_create(const char *fpath, scws_io_size_t base, scws_io_size_t prime)
 	struct xdb_header xhdr;
 
 	/* create the new memory */
-	if (!(x = (xdb_t ) malloc(sizeof(xdb_st))))
+	if (!(x = (xdb_t ) xmalloc(sizeof(xdb_st))))
 		return NULL;
 
 	/* try to open & check the file */
@@ -202,7 +208,7 @@ xdb_t xdb_create(const char *fpath, scws_io_size_t base, scws_io_size_t prime)
 #ifdef DEBUG
 		perror("Failed to open & create the db file");
 #endif
-		free(x);
+		xfree(x);
 		return NULL;
 	}
 
@@ -251,7 +257,7 @@ void xdb_close(xdb_t x)
 		close(x->fd);
 		x->fd = -1;
 	}
-	free(x);
+	xfree(x);
 }
 
 /* read mode (value require free by user) */
@@ -268,7 +274,7 @@ void *xdb_nget(xdb_t x, const char *key, scws_io_size_t len, scws_io_size_t *vle
 	if (rec.value.len > 0)
 	{
 		/* auto append one byte with '\0' */		
-		value = malloc(rec.value.len + 1);
+		value = xmalloc(rec.value.len + 1);
 		if (vlen != NULL)		
 			*vlen = rec.value.len;
 		_xdb_read_data(x, value, rec.value.off, rec.value.len);
@@ -360,7 +366,7 @@ static void _xdb_draw_node(xdb_t x, xptr_t ptr, struct draw_arg *arg, int depth,
 {
 	char *icon2;
 	
-	icon2 = malloc(strlen(icon1) + 4);
+	icon2 = xmalloc(strlen(icon1) + 4);
 	strcpy(icon2, icon1);
 
 	// output the flag & icon
@@ -413,7 +419,7 @@ static void _xdb_draw_node(xdb_t x, xptr_t ptr, struct draw_arg *arg, int depth,
 		memcpy(ptr, buf + sizeof(xptr_st), sizeof(xptr_st));
 		_xdb_draw_node(x, ptr, arg, depth, icon2);
 	}
-	free(icon2);
+	xfree(icon2);
 }
 
 void xdb_draw(xdb_t x)
@@ -583,16 +589,16 @@ void xdb_optimize(xdb_t x)
 		struct _xdb_node_cnt counts = _xdb_count_nodes(x, i);
 		if (counts.n <= 2) continue;
 
-		xcmper_st *nodes_array = (xcmper_st *) malloc(sizeof(xcmper_st) * counts.n);
+		xcmper_st *nodes_array = (xcmper_st *) xmalloc(sizeof(xcmper_st) * counts.n);
 		// TsXor: allocate spaces for all keys in one go
-		char *keys_buf = (char *) malloc(counts.klen);
+		char *keys_buf = (char *) xmalloc(counts.klen);
 		scws_io_size_t n_loaded = _xdb_load_nodes(x, i, nodes_array, keys_buf);
 		qsort(nodes_array, n_loaded, sizeof(xcmper_st), _xdb_node_cmp);
 		_xdb_reorganize_nodes(x, i, nodes_array, n_loaded);
 
 		/* free the nodes & key pointer */
-		free(keys_buf);
-		free(nodes_array);
+		xfree(keys_buf);
+		xfree(nodes_array);
 	}
 }
 
@@ -612,7 +618,7 @@ static void _xdb_to_xtree_node(xdb_t x, xtree_t xt, xptr_t ptr)
 	if (ptr->len == 0)
 		return;
 
-	buf = (unsigned char *) malloc(ptr->len + 1);
+	buf = (unsigned char *) xmalloc(ptr->len + 1);
 	_xdb_read_data(x, buf, ptr->off, ptr->len);
 
 	/* save the key & value -> xtree */
@@ -632,7 +638,7 @@ static void _xdb_to_xtree_node(xdb_t x, xtree_t xt, xptr_t ptr)
 	memcpy(ptr, buf + sizeof(xptr_st), sizeof(xptr_st));
 	_xdb_to_xtree_node(x, xt, ptr);
 
-	free(buf);
+	xfree(buf);
 }
 
 xtree_t xdb_to_xtree(xdb_t x, xtree_t xt)
@@ -645,6 +651,13 @@ xtree_t xdb_to_xtree(xdb_t x, xtree_t xt)
 
 	if (!xt && !(xt = xtree_new(x->base, x->prime)))
 		return NULL;
+
+	// a whole big dict in memory, its blocks grow up to huge pages
+	if (x->fsize > POOL_HUGE_SIZ)
+	{
+		xt->p->blk_max = POOL_HUGE_SIZ;
+		xt->p->flags |= POOL_HUGEPAGE;
+	}
 	
     do
 	{
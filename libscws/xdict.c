@@ -15,6 +15,9 @@
 #include "xtree.h"
 #include "xdb.h"
 #include "crc32.h"
+#include "xthread.h"
+#include "charset.h"
+#include "xalloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -100,6 +103,37 @@ static void _realpath(const char *src, char *dst)
 #    define	_realpath	realpath
 #endif
 
+/* the values of an old dict (no id) are short, pad them to word_st once loaded */
+static void _xdict_pad_node(xtree_t xt, node_t node)
+{
+	word_t w;
+
+	for (; node != NULL; node = node->right)
+	{
+		if (node->vlen < sizeof(word_st))
+		{
+			w = (word_t) pmalloc_z(xt->p, sizeof(word_st));
+			memcpy(w, node->value, node->vlen);
+			node->value = (void *) w;
+			node->vlen = sizeof(word_st);
+		}
+		_xdict_pad_node(xt, node->left);
+	}
+}
+
+static xtree_t _xdict_to_xtree(xdb_t x)
+{
+	xtree_t xt;
+	scws_io_size_t i;
+
+	if ((xt = xdb_to_xtree(x, NULL)) != NULL)
+	{
+		for (i = 0; i < xt->prime; i++)
+			_xdict_pad_node(xt, xt->trees[i]);
+	}
+	return xt;
+}
+
 /* open the text dict */
 static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 {
@@ -130,14 +164,14 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 		xdb_t x;
 		if ((x = xdb_open(tmpfile, 'r')) != NULL)
 		{
-			xd = (xdict_t) malloc(sizeof(xdict_st));
+			xd = (xdict_t) xmalloc(sizeof(xdict_st));
 			memset(xd, 0, sizeof(xdict_st));
 			xd->ref = 1;
 
 			if (mode & SCWS_XDICT_MEM)
 			{
 				/* convert the xdb(disk) -> xtree(memory) */
-				if ((xt = xdb_to_xtree(x, NULL)) != NULL)
+				if ((xt = _xdict_to_xtree(x)) != NULL)
 				{
 					xdb_close(x);
 					xd->xdict = (void *) xt;
@@ -159,6 +193,7 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 		scws_io_size_t cl, kl;
 		FILE *fp;
 		word_st word, *w;
+		unsigned long id;
 		char *key, *part, *last, *delim = " \t\r\n";
 
 		// re-build the xdb file from text file	
@@ -169,7 +204,7 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 		word.attr[2] = '\0';
 		while (fgets(buf, sizeof(buf) - 1, fp) != NULL)
 		{
-			// <word>[\t<tf>[\t<idf>[\t<attr>]]]		
+			// <word>[\t<tf>[\t<idf>[\t<attr>[\t<id>]]]]
 			if (buf[0] == ';' || buf[0] == '#') continue;
 
 			key = _strtok_r(buf, delim, &last);
@@ -183,6 +218,8 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 				word.flag = SCWS_WORD_FULL;
 				word.attr[0] = '@';
 				word.attr[1] = '\0';
+				word.id = 0;
+				id = 0;
 
 				if (!(part = _strtok_r(NULL, delim, &last))) break;
 				word.tf = (float) atof(part);
@@ -190,14 +227,24 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 				if (!(part = _strtok_r(NULL, delim, &last))) break;
 				word.idf = (float) atof(part);
 
-				if (part = _strtok_r(NULL, delim, &last))
-				{
-					word.attr[0] = part[0];
-					if (part[1]) word.attr[1] = part[1];
-				}
+				if (!(part = _strtok_r(NULL, delim, &last))) break;
+				word.attr[0] = part[0];
+				if (part[1]) word.attr[1] = part[1];
+
+				if (!(part = _strtok_r(NULL, delim, &last))) break;
+				id = strtoul(part, NULL, 10);
 			}
 			while (0);
 
+			// the hashed ids have the high bit set, refuse the dict rather than mix them up
+			if (id >= SCWS_WORD_ID_HASHED)
+			{
+				fclose(fp);
+				xtree_free(xt);
+				return NULL;
+			}
+			word.id = (unsigned int) id;
+
 			// save into xtree
 			if ((w = xtree_nget(xt, key, kl, NULL)) == NULL)
 			{
@@ -211,6 +258,7 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 				w->idf = word.idf;
 				w->flag |= word.flag;
 				strcpy(w->attr, word.attr);
+				w->id = word.id;
 			}
 
 			// parse the part	
@@ -239,7 +287,7 @@ static xdict_t _xdict_open_txt(const char *fpath, int mode, unsigned char *ml)
 		chmod(tmpfile, 0777);
 
 		// return xtree
-		xd = (xdict_t) malloc(sizeof(xdict_st));
+		xd = (xdict_t) xmalloc(sizeof(xdict_st));
 		memset(xd, 0, sizeof(xdict_st));
 		xd->ref = 1;
 		xd->xdict = (void *) xt;
@@ -257,7 +305,7 @@ xdict_t xdict_open(const char *fpath, int mode)
 	if (!(x = xdb_open(fpath, 'r')))
 		return NULL;
 
-	xd = (xdict_t) malloc(sizeof(xdict_st));
+	xd = (xdict_t) xmalloc(sizeof(xdict_st));
 	memset(xd, 0, sizeof(xdict_st));
 	xd->ref = 1;
 	if (mode & SCWS_XDICT_MEM)
@@ -265,7 +313,7 @@ xdict_t xdict_open(const char *fpath, int mode)
 		xtree_t xt;
 
 		/* convert the xdb(disk) -> xtree(memory) */
-		if ((xt = xdb_to_xtree(x, NULL)) != NULL)
+		if ((xt = _xdict_to_xtree(x)) != NULL)
 		{
 			xdb_close(x);
 			xd->xdict = (void *) xt;
@@ -293,17 +341,119 @@ xdict_t xdict_add(xdict_t xd, const char *fpath, int mode, unsigned char *ml)
 	return xd;
 }
 
-/* fork the dict */
+/* fork the dict (atomic refcount, forks & closes may race in threads) */
 xdict_t xdict_fork(xdict_t xd)
 {
 	xdict_t xx;
 	for (xx = xd; xx != NULL; xx = xx->next)
 	{
-		xx->ref++;
+		xthread_atomic_add(&xx->ref, 1);
 	}
 	return xd;
 }
 
+/* per-char table indexed by charset_zindex(), pages of 256 chars are
+ * allocated & filled on demand (a short-lived handle on xdb won't pay for the whole table),
+ * an entry is claimed by CAS, then published by a store-release of its state */
+#define	XDICT_ZPAGES		(CHARSET_ZINDEX_MAX >> 8)
+
+#define	XDICT_ZENT_NONE		0	/* unknown */
+#define	XDICT_ZENT_BUSY		1	/* being filled */
+#define	XDICT_ZENT_MISS		2	/* not in the dicts */
+#define	XDICT_ZENT_WORD		3
+
+struct xdict_zent
+{
+	word_st w;
+	volatile unsigned char state;
+};
+
+static void _xdict_ztab_free(xdict_t xd)
+{
+	void **tab;
+	int i;
+
+	if ((tab = (void **) xd->ztab) != NULL)
+	{
+		for (i = 0; i < XDICT_ZPAGES; i++)
+		{
+			if (tab[i] != NULL)
+				xfree(tab[i]);
+		}
+		xfree(tab);
+		xd->ztab = NULL;
+	}
+}
+
+/* get the page (allocate it if not yet), NULL if out of memory */
+static struct xdict_zent *_xdict_zpage(xdict_t xd, int i)
+{
+	void *volatile *tab;
+	void *page;
+
+	if ((tab = (void *volatile *) xthread_load_ptr(&xd->ztab)) == NULL)
+	{
+		if ((tab = (void *volatile *) xcalloc(XDICT_ZPAGES, sizeof(void *))) == NULL)
+			return NULL;
+		if (!xthread_cas_ptr(&xd->ztab, NULL, (void *) tab))
+		{
+			xfree((void *) tab);
+			tab = (void *volatile *) xthread_load_ptr(&xd->ztab);
+		}
+	}
+	if ((page = xthread_load_ptr(&tab[i])) == NULL)
+	{
+		if ((page = xcalloc(256, sizeof(struct xdict_zent))) == NULL)
+			return NULL;
+		if (!xthread_cas_ptr(&tab[i], NULL, page))
+		{
+			xfree(page);
+			page = xthread_load_ptr(&tab[i]);
+		}
+	}
+	return (struct xdict_zent *) page;
+}
+
+word_t xdict_query_z(xdict_t xd, const char *key, scws_io_size_t len)
+{
+	struct xdict_zent *ze;
+	word_t w;
+	int i;
+
+	if (xd == NULL || (i = charset_zindex((const unsigned char *) key, (int) len)) < 0
+		|| (ze = _xdict_zpage(xd, i >> 8)) == NULL)
+	{
+		return xdict_query(xd, key, len);
+	}
+
+	ze += (i & 0xff);
+	switch (xthread_load_acquire(&ze->state))
+	{
+		case XDICT_ZENT_WORD :
+			return &ze->w;
+		case XDICT_ZENT_MISS :
+			return NULL;
+		case XDICT_ZENT_NONE :
+			if (xthread_cas_u8(&ze->state, XDICT_ZENT_NONE, XDICT_ZENT_BUSY))
+				break;
+		default :
+			/* filled by another thread now */
+			return xdict_query(xd, key, len);
+	}
+
+	if ((w = xdict_query(xd, key, len)) == NULL)
+	{
+		xthread_store_release(&ze->state, XDICT_ZENT_MISS);
+		return NULL;
+	}
+	memcpy(&ze->w, w, sizeof(word_st));
+	ze->w.flag &= ~SCWS_WORD_MALLOCED;
+	if (w->flag & SCWS_WORD_MALLOCED)
+		xfree(w);
+	xthread_store_release(&ze->state, XDICT_ZENT_WORD);
+	return &ze->w;
+}
+
 /* close the dict */
 void xdict_close(xdict_t xd)
 {
@@ -312,26 +462,43 @@ void xdict_close(xdict_t xd)
 	while ((xx = xd) != NULL)
 	{
 		xd = xx->next;
-		xx->ref--;
-		if (xx->ref == 0)
+		if (xthread_atomic_add(&xx->ref, -1) == 0)
 		{
+			_xdict_ztab_free(xx);
 			if (xx->xmode == SCWS_XDICT_MEM)
 				xtree_free((xtree_t) xx->xdict);
 			else
 			{
 				xdb_close((xdb_t) xx->xdict);
 			}
-			free(xx);
+			xfree(xx);
 		}
 	}
 }
 
-/* query the word */
+/* query the word, the dicts are never modified (shared by threads) */
 #define	_FLAG_BOTH(x)	(((x)->flag & (SCWS_WORD_PART|SCWS_WORD_FULL)) == (SCWS_WORD_PART|SCWS_WORD_FULL))
 #define	_FLAG_FULL(x)	((x)->flag & SCWS_WORD_FULL)
 #define	_FLAG_PART(x)	((x)->flag & SCWS_WORD_PART)
 #define	_FLAG_MALLOC(x)	((x)->flag & SCWS_WORD_MALLOCED)
 
+/* full word of one dict & part of another, flag it on a private copy */
+static word_t _xdict_both(word_t value)
+{
+	word_t w;
+
+	if (_FLAG_MALLOC(value))
+		w = value;
+	else
+	{
+		w = (word_t) xmalloc(sizeof(word_st));
+		memcpy(w, value, sizeof(word_st));
+		w->flag |= SCWS_WORD_MALLOCED;
+	}
+	w->flag |= SCWS_WORD_PART;
+	return w;
+}
+
 word_t xdict_query(xdict_t xd, const char *key, scws_io_size_t len)
 {
 	word_t value, value2;
@@ -347,8 +514,18 @@ word_t xdict_query(xdict_t xd, const char *key, scws_io_size_t len)
 		else
 		{
 			/* the value malloced in lib-XDB. free required */
-			value = (word_t) xdb_nget((xdb_t) xd->xdict, key, len, NULL);
-			if (value != NULL) value->flag |= SCWS_WORD_MALLOCED;
+			scws_io_size_t vlen;
+
+			value = (word_t) xdb_nget((xdb_t) xd->xdict, key, len, &vlen);
+			if (value != NULL)
+			{
+				if (vlen < sizeof(word_st))
+				{
+					value = (word_t) xrealloc(value, sizeof(word_st));
+					memset((char *) value + vlen, 0, sizeof(word_st) - vlen);
+				}
+				value->flag |= SCWS_WORD_MALLOCED;
+			}
 		}
 		xd = xd->next;
 
@@ -365,20 +542,18 @@ word_t xdict_query(xdict_t xd, const char *key, scws_io_size_t len)
 			{
 				if (_FLAG_FULL(value2) && _FLAG_PART(value))
 				{
-					value2->flag |= SCWS_WORD_PART;
 					if (_FLAG_MALLOC(value))
-						free(value);
-					return value2;
+						xfree(value);
+					return _xdict_both(value2);
 				}
 				if (_FLAG_FULL(value) && _FLAG_PART(value2))
 				{
-					value->flag |= SCWS_WORD_PART;
 					if (_FLAG_MALLOC(value2))
-						free(value2);
-					return value;
+						xfree(value2);
+					return _xdict_both(value);
 				}
 				if (_FLAG_MALLOC(value))
-					free(value);
+					xfree(value);
 			}
 		}
 	}
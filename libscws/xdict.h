@@ -38,21 +38,27 @@ extern "C" {
 
 #include "xsize.h"
 
-/* data structure for word(12bytes) */
+/* data structure for word(16bytes), id: stable id of the entry given by scws-gen-dict (0: none).
+ * the old dicts keep 12 bytes (no id), the missing bytes are read as zero */
 typedef struct scws_word
 {
 	float tf;
 	float idf;
 	unsigned char flag;
 	char attr[3];
+	unsigned int id;
 }	word_st, *word_t;
 
+/* the ids of dict entries are below it, the tokens without one are hashed over it (see scws_hash_id) */
+#define	SCWS_WORD_ID_HASHED	0x80000000U
+
 typedef struct scws_xdict
 {
 	void *xdict;
 	int xmode;
 	int ref;	// hightman.20130110: refcount (zero to really free/close)
 	struct scws_xdict *next;
+	void *volatile ztab;	// per-char table of the chain from here, see xdict_query_z
 }	xdict_st, *xdict_t;
 
 /* pub function (api) */
@@ -68,6 +74,10 @@ xdict_t xdict_add(xdict_t xd, const char *fpath, int mode, unsigned char *ml);
 /* NOW this is ThreadSafe function */
 word_t xdict_query(xdict_t xd, const char *key, scws_io_size_t len);
 
+/* query a single char (2 bytes, or 3 bytes utf-8) by the direct-indexed table of the chain,
+ * filled on demand, the result is shared & read-only (never MALLOCED). other keys: xdict_query */
+word_t xdict_query_z(xdict_t xd, const char *key, scws_io_size_t len);
+
 #ifdef __cplusplus
 }
 #endif
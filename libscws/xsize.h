@@ -1,6 +1,7 @@
 #ifndef __XSIZE_H__
 #define __XSIZE_H__
 
+#include <stddef.h>
 #include <stdint.h>
 typedef size_t scws_max_size_t;
 typedef uint32_t scws_io_size_t;
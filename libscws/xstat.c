@@ -0,0 +1,350 @@
+/**
+ * @file xstat.c (word stats accumulator: hash table + heap top-k, mergeable)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "xstat.h"
+#include "xalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define	XSTAT_MAGIC			"XSTA"
+#define	XSTAT_VERSION		1
+#define	XSTAT_INIT_SIZE		1024
+
+/* on-disk header & item head, the word bytes follow each item head */
+struct xstat_header
+{
+	char magic[4];
+	int version;
+	int cap;
+	int num;
+};
+
+struct xstat_record
+{
+	int len;
+	int times;
+	float weight;
+	float error;
+	char attr[4];
+};
+
+/* fnv-1a */
+static inline unsigned int _xstat_hash(const char *s, int len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len--)
+	{
+		h ^= (unsigned char) *s++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* the item a is worse (less weight, then the later one) than b */
+#define	_XSTAT_WORSE(x,a,b)	((x)->items[a].weight < (x)->items[b].weight		\
+	|| ((x)->items[a].weight == (x)->items[b].weight && (a) > (b)))
+
+/* min-heap on item indexes */
+static void _xstat_sift_down(xstat_t x, int *heap, int num, int i, int track)
+{
+	int c, t;
+
+	while ((c = (i << 1) + 1) < num)
+	{
+		if ((c + 1) < num && _XSTAT_WORSE(x, heap[c+1], heap[c]))
+			c++;
+		if (!_XSTAT_WORSE(x, heap[c], heap[i]))
+			break;
+		t = heap[c]; heap[c] = heap[i]; heap[i] = t;
+		if (track)
+		{
+			x->items[heap[i]].heap = i;
+			x->items[heap[c]].heap = c;
+		}
+		i = c;
+	}
+}
+
+static void _xstat_sift_up(xstat_t x, int *heap, int i, int track)
+{
+	int p, t;
+
+	while (i > 0 && _XSTAT_WORSE(x, heap[i], heap[(p = (i - 1) >> 1)]))
+	{
+		t = heap[p]; heap[p] = heap[i]; heap[i] = t;
+		if (track)
+		{
+			x->items[heap[i]].heap = i;
+			x->items[heap[p]].heap = p;
+		}
+		i = p;
+	}
+}
+
+static void _xstat_rehash(xstat_t x, int nbucket)
+{
+	int i, h;
+
+	x->nbucket = nbucket;
+	x->bucket = (int *) xrealloc(x->bucket, sizeof(int) * nbucket);
+	memset(x->bucket, -1, sizeof(int) * nbucket);
+	for (i = 0; i < x->num; i++)
+	{
+		h = _xstat_hash(x->items[i].word, x->items[i].len) & (nbucket - 1);
+		x->items[i].next = x->bucket[h];
+		x->bucket[h] = i;
+	}
+}
+
+xstat_t xstat_new(int cap)
+{
+	xstat_t x;
+
+	x = (xstat_t) xmalloc(sizeof(xstat_st));
+	memset(x, 0, sizeof(xstat_st));
+	x->cap = (cap > 0 ? cap : 0);
+	x->size = ((x->cap > 0 && x->cap < XSTAT_INIT_SIZE) ? x->cap : XSTAT_INIT_SIZE);
+	x->items = (struct xstat_item *) xmalloc(sizeof(struct xstat_item) * x->size);
+	if (x->cap > 0)
+		x->heap = (int *) xmalloc(sizeof(int) * x->size);
+	for (cap = 4; cap < x->size; cap <<= 1);
+	_xstat_rehash(x, cap);
+	return x;
+}
+
+void xstat_free(xstat_t x)
+{
+	int i;
+
+	for (i = 0; i < x->num; i++)
+		xfree(x->items[i].word);
+	xfree(x->items);
+	xfree(x->bucket);
+	if (x->heap != NULL)
+		xfree(x->heap);
+	xfree(x);
+}
+
+/* error: the weight overestimated already (merged or loaded from an approx state) */
+static void _xstat_add(xstat_t x, const char *word, int len, const char *attr, float weight, int times, float error)
+{
+	struct xstat_item *it;
+	int h, i, *pp, taken = 0;
+
+	h = _xstat_hash(word, len) & (x->nbucket - 1);
+	for (i = x->bucket[h]; i >= 0; i = x->items[i].next)
+	{
+		it = &x->items[i];
+		if (it->len == len && !memcmp(it->word, word, len))
+		{
+			it->weight += weight;
+			it->times += times;
+			it->error += error;
+			if (x->heap != NULL)
+				_xstat_sift_down(x, x->heap, x->num, it->heap, 1);
+			return;
+		}
+	}
+
+	if (x->cap > 0 && x->num == x->cap)
+	{
+		/* Space-Saving: take over the lightest word */
+		i = x->heap[0];
+		it = &x->items[i];
+		for (pp = &x->bucket[_xstat_hash(it->word, it->len) & (x->nbucket - 1)]; *pp != i; pp = &x->items[*pp].next);
+		*pp = it->next;
+		xfree(it->word);
+		taken = 1;
+		it->error = it->weight + error;
+		it->weight += weight;
+		it->times += times;
+	}
+	else
+	{
+		if (x->num == x->size)
+		{
+			// the cap is reached by growing, not allocated up front
+			x->size <<= 1;
+			if (x->cap > 0 && x->size > x->cap)
+				x->size = x->cap;
+			x->items = (struct xstat_item *) xrealloc(x->items, sizeof(struct xstat_item) * x->size);
+			if (x->heap != NULL)
+				x->heap = (int *) xrealloc(x->heap, sizeof(int) * x->size);
+		}
+		i = x->num++;
+		it = &x->items[i];
+		it->error = error;
+		it->weight = weight;
+		it->times = times;
+		if (x->heap != NULL)
+		{
+			x->heap[i] = i;
+			it->heap = i;
+		}
+	}
+
+	it->word = (char *) xmalloc(len + 1);
+	memcpy(it->word, word, len);
+	it->word[len] = '\0';
+	it->len = len;
+	strncpy(it->attr, attr, 2);
+	it->attr[2] = '\0';
+	it->next = x->bucket[h];
+	x->bucket[h] = i;
+
+	if (x->heap != NULL)
+	{
+		if (taken)
+			_xstat_sift_down(x, x->heap, x->num, it->heap, 1);
+		else
+			_xstat_sift_up(x, x->heap, it->heap, 1);
+	}
+	if (!taken && x->num > (x->nbucket - (x->nbucket >> 2)))
+		_xstat_rehash(x, x->nbucket << 1);
+}
+
+void xstat_add(xstat_t x, const char *word, int len, const char *attr, float weight, int times)
+{
+	_xstat_add(x, word, len, attr, weight, times, 0.0);
+}
+
+void xstat_merge(xstat_t dst, xstat_t src)
+{
+	struct xstat_item *it;
+	int i;
+
+	for (i = 0; i < src->num; i++)
+	{
+		it = &src->items[i];
+		_xstat_add(dst, it->word, it->len, it->attr, it->weight, it->times, it->error);
+	}
+}
+
+int xstat_top(xstat_t x, struct xstat_item **list, int limit)
+{
+	int *heap, i, n;
+
+	if (limit <= 0 || limit > x->num)
+		limit = x->num;
+	if (limit == 0)
+		return 0;
+
+	/* keep the heaviest limit items in a min-heap */
+	heap = (int *) xmalloc(sizeof(int) * limit);
+	for (i = n = 0; i < x->num; i++)
+	{
+		if (n < limit)
+		{
+			heap[n] = i;
+			_xstat_sift_up(x, heap, n++, 0);
+		}
+		else if (_XSTAT_WORSE(x, heap[0], i))
+		{
+			heap[0] = i;
+			_xstat_sift_down(x, heap, n, 0, 0);
+		}
+	}
+
+	/* pop the lightest to the tail */
+	while (n > 0)
+	{
+		list[--n] = &x->items[heap[0]];
+		heap[0] = heap[n];
+		_xstat_sift_down(x, heap, n, 0, 0);
+	}
+	xfree(heap);
+	return limit;
+}
+
+int xstat_save(xstat_t x, const char *fpath)
+{
+	struct xstat_header hdr;
+	struct xstat_record rec;
+	struct xstat_item *it;
+	FILE *fp;
+	int i;
+
+	if ((fp = fopen(fpath, "wb")) == NULL)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, XSTAT_MAGIC, 4);
+	hdr.version = XSTAT_VERSION;
+	hdr.cap = x->cap;
+	hdr.num = x->num;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	for (i = 0; i < x->num; i++)
+	{
+		it = &x->items[i];
+		memset(&rec, 0, sizeof(rec));
+		rec.len = it->len;
+		rec.times = it->times;
+		rec.weight = it->weight;
+		rec.error = it->error;
+		memcpy(rec.attr, it->attr, 2);
+		fwrite(&rec, sizeof(rec), 1, fp);
+		fwrite(it->word, it->len, 1, fp);
+	}
+	i = ferror(fp) ? -1 : 0;
+	fclose(fp);
+	return i;
+}
+
+xstat_t xstat_load(const char *fpath)
+{
+	struct xstat_header hdr;
+	struct xstat_record rec;
+	xstat_t x;
+	FILE *fp;
+	char *buf;
+	long fsize;
+	int i, size;
+
+	if ((fp = fopen(fpath, "rb")) == NULL)
+		return NULL;
+
+	// each item takes a record at least, the cap itself costs nothing until it is filled
+	fseek(fp, 0, SEEK_END);
+	fsize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, XSTAT_MAGIC, 4)
+		|| hdr.version != XSTAT_VERSION || hdr.num < 0 || (hdr.cap > 0 && hdr.num > hdr.cap)
+		|| hdr.num > ((fsize - (long) sizeof(hdr)) / (long) sizeof(rec)))
+	{
+		fclose(fp);
+		return NULL;
+	}
+
+	x = xstat_new(hdr.cap);
+	size = 256;
+	buf = (char *) xmalloc(size);
+	for (i = 0; i < hdr.num; i++)
+	{
+		if (fread(&rec, sizeof(rec), 1, fp) != 1 || rec.len < 0 || rec.len > fsize)
+			break;
+		if (rec.len > size)
+			buf = (char *) xrealloc(buf, (size = rec.len));
+		if (rec.len > 0 && fread(buf, rec.len, 1, fp) != 1)
+			break;
+		_xstat_add(x, buf, rec.len, rec.attr, rec.weight, rec.times, rec.error);
+	}
+	xfree(buf);
+	fclose(fp);
+
+	if (i != hdr.num)
+	{
+		xstat_free(x);
+		return NULL;
+	}
+	return x;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file xstat.h (word stats accumulator: hash table + heap top-k, mergeable)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifndef	_SCWS_XSTAT_20261018_H_
+#define	_SCWS_XSTAT_20261018_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a counted word */
+struct xstat_item
+{
+	char *word;
+	int len;
+	float weight;		/* sum of idf */
+	float error;		/* approx mode: weight may be overestimated at most by this */
+	int times;
+	char attr[3];
+	int next;			/* hash chain */
+	int heap;			/* approx mode: position in the min-heap */
+};
+
+typedef struct
+{
+	int cap;			/* max words, 0: exact (unbounded) */
+	int num;
+	int size;
+	int nbucket;
+	int *bucket;
+	int *heap;			/* approx mode: min-heap of weight (Space-Saving) */
+	struct xstat_item *items;
+}	xstat_st, *xstat_t;
+
+/* cap = 0: exact counting, cap > 0: keep cap words at most (Space-Saving approximate) */
+xstat_t xstat_new(int cap);
+void xstat_free(xstat_t x);
+
+/* count a word, weight/times are added to it */
+void xstat_add(xstat_t x, const char *word, int len, const char *attr, float weight, int times);
+
+/* add all of src into dst, the error bounds of src are carried over */
+void xstat_merge(xstat_t dst, xstat_t src);
+
+/* the heaviest limit (<=0: all) words to list (sorted by weight desc), return the number */
+int xstat_top(xstat_t x, struct xstat_item **list, int limit);
+
+/* save & load the (partial) state, save return 0 on success, load return NULL on failure */
+int xstat_save(xstat_t x, const char *fpath);
+xstat_t xstat_load(const char *fpath);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
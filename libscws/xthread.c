@@ -0,0 +1,80 @@
+/**
+ * @file xthread.c (tiny portable thread & atomic wrapper)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "compat.h"
+
+#include "xthread.h"
+#include "xalloc.h"
+#include <stdlib.h>
+
+#ifdef _WIN32
+struct _xthread_arg
+{
+	xthread_func_t func;
+	void *arg;
+};
+
+static DWORD WINAPI _xthread_start(LPVOID param)
+{
+	struct _xthread_arg a = *((struct _xthread_arg *) param);
+
+	xfree(param);
+	a.func(a.arg);
+	return 0;
+}
+#endif
+
+int xthread_create(xthread_t *t, xthread_func_t func, void *arg)
+{
+#if defined(_WIN32)
+	struct _xthread_arg *a;
+
+	if ((a = (struct _xthread_arg *) xmalloc(sizeof(struct _xthread_arg))) == NULL)
+		return -1;
+	a->func = func;
+	a->arg = arg;
+	if ((*t = CreateThread(NULL, 0, _xthread_start, a, 0, NULL)) == NULL)
+	{
+		xfree(a);
+		return -1;
+	}
+	return 0;
+#elif defined(HAVE_PTHREAD)
+	return (pthread_create(t, NULL, func, arg) == 0 ? 0 : -1);
+#else
+	return -1;
+#endif
+}
+
+void xthread_join(xthread_t t)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+#elif defined(HAVE_PTHREAD)
+	pthread_join(t, NULL);
+#endif
+}
+
+int xthread_ncpu()
+{
+	int n = 1;
+
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	n = (int) si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return (n > 0 ? n : 1);
+}
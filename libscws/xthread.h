@@ -0,0 +1,110 @@
+/**
+ * @file xthread.h (tiny portable thread & atomic wrapper)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifndef	_SCWS_XTHREAD_20261018_H_
+#define	_SCWS_XTHREAD_20261018_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#	include <windows.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#	endif
+typedef HANDLE xthread_t;
+#elif defined(HAVE_PTHREAD)
+#	include <pthread.h>
+typedef pthread_t xthread_t;
+#else
+typedef int xthread_t;
+#endif
+
+typedef void *(*xthread_func_t)(void *arg);
+
+/* start a thread, succ: 0, error or no thread support: -1 (then run func by yourself) */
+int xthread_create(xthread_t *t, xthread_func_t func, void *arg);
+void xthread_join(xthread_t t);
+
+/* number of online cpus (>=1) */
+int xthread_ncpu();
+
+/* atomic add, return the new value */
+static inline int xthread_atomic_add(volatile int *ptr, int val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __sync_add_and_fetch(ptr, val);
+#elif defined(_MSC_VER)
+	return (int) InterlockedExchangeAdd((volatile LONG *) ptr, (LONG) val) + val;
+#else
+	return (*ptr += val);
+#endif
+}
+
+/* publish data to other threads: a store-release after writing it, a load-acquire before reading it */
+static inline unsigned char xthread_load_acquire(volatile unsigned char *ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+	return *ptr;	/* msvc: volatile has acquire semantics */
+#endif
+}
+
+static inline void xthread_store_release(volatile unsigned char *ptr, unsigned char val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+#else
+	*ptr = val;
+#endif
+}
+
+static inline void *xthread_load_ptr(void *volatile *ptr)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#else
+	return *ptr;
+#endif
+}
+
+/* compare & swap, return 1 if *ptr was old & replaced by val */
+static inline int xthread_cas_ptr(void *volatile *ptr, void *old, void *val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __sync_bool_compare_and_swap(ptr, old, val);
+#elif defined(_MSC_VER)
+	return InterlockedCompareExchangePointer(ptr, val, old) == old;
+#else
+	if (*ptr != old)
+		return 0;
+	*ptr = val;
+	return 1;
+#endif
+}
+
+static inline int xthread_cas_u8(volatile unsigned char *ptr, unsigned char old, unsigned char val)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __sync_bool_compare_and_swap(ptr, old, val);
+#elif defined(_MSC_VER)
+	return _InterlockedCompareExchange8((volatile char *) ptr, (char) val, (char) old) == (char) old;
+#else
+	if (*ptr != old)
+		return 0;
+	*ptr = val;
+	return 1;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
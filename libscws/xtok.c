@@ -0,0 +1,351 @@
+/**
+ * @file xtok.c (binary pre-segmented token stream: writer & mmap reader)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
+#include "compat.h"
+#include "xtok.h"
+#include "xalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#ifdef HAVE_MMAP
+#   include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#	define	O_BINARY	0
+#endif
+
+#define	XTOK_ATTR_CODE(a)	((unsigned char) (a)[0] | ((a)[0] ? ((unsigned char) (a)[1] << 8) : 0))
+#define	XTOK_MAX_ATTR		0xffff
+#define	XTOK_ID_HASHED		0x80000000U
+
+/* the hashed id of a word out of the dict (see scws_hash_id), fnv-1a with bit 31 set */
+static unsigned int _xtok_hash_id(const unsigned char *s, int len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len-- > 0)
+	{
+		h ^= *s++;
+		h *= 16777619U;
+	}
+	return h | XTOK_ID_HASHED;
+}
+
+static inline int _varint_put(unsigned char *p, unsigned int v)
+{
+	int n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = (unsigned char) (v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (unsigned char) v;
+	return n;
+}
+
+static inline unsigned int _varint_get(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	unsigned int v = 0;
+	int shift = 0;
+
+	while (p < end && (*p & 0x80) && shift < 28)
+	{
+		v |= (unsigned int) (*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	if (p < end)
+		v |= (unsigned int) *p++ << shift;
+	*pp = p;
+	return v;
+}
+
+static void _xtok_write(xtok_writer_t w, const void *buf, size_t len)
+{
+	if (len > 0 && fwrite(buf, len, 1, (FILE *) w->fp) != 1)
+		w->error = 1;
+	w->pos += len;
+}
+
+xtok_writer_t xtok_create(const char *fpath, int flags)
+{
+	xtok_writer_t w;
+	struct xtok_header hdr;
+	FILE *fp;
+
+	if ((fp = fopen(fpath, "wb")) == NULL)
+		return NULL;
+
+	w = (xtok_writer_t) xmalloc(sizeof(xtok_writer_st));
+	memset(w, 0, sizeof(xtok_writer_st));
+	w->fp = (void *) fp;
+	w->flags = flags & (XTOK_F_TEXT | XTOK_F_ID);
+	w->amap = (unsigned short *) xmalloc(sizeof(unsigned short) * (XTOK_MAX_ATTR + 1));
+	memset(w->amap, 0, sizeof(unsigned short) * (XTOK_MAX_ATTR + 1));
+	w->attrs = (char (*)[4]) xmalloc(sizeof(w->attrs[0]) * 16);
+	w->dsize = 1024;
+	w->docs = (struct xtok_doc *) xmalloc(sizeof(struct xtok_doc) * w->dsize);
+
+	/* the real header is written by xtok_finish */
+	memset(&hdr, 0, sizeof(hdr));
+	_xtok_write(w, &hdr, sizeof(hdr));
+	return w;
+}
+
+void xtok_doc_begin(xtok_writer_t w, const char *text, int len)
+{
+	struct xtok_doc *d;
+
+	if (w->ndoc == w->dsize)
+	{
+		w->dsize <<= 1;
+		w->docs = (struct xtok_doc *) xrealloc(w->docs, sizeof(struct xtok_doc) * w->dsize);
+	}
+	d = &w->docs[w->ndoc];
+	d->off = w->pos;
+	d->ntok = 0;
+	d->len = 0;
+	w->text = NULL;
+	if ((w->flags & XTOK_F_TEXT) && text != NULL && len > 0)
+	{
+		d->len = len;
+		_xtok_write(w, text, len);
+		w->text = (const unsigned char *) text;
+	}
+	w->last = 0;
+}
+
+void xtok_put(xtok_writer_t w, int off, int len, const char *attr, float idf, unsigned int id)
+{
+	unsigned char buf[32];
+	unsigned int code, q;
+	int n, delta;
+
+	/* attr id, interned in the order of first use */
+	code = XTOK_ATTR_CODE(attr);
+	if (w->amap[code] == 0)
+	{
+		if ((w->nattr & 15) == 0)
+			w->attrs = (char (*)[4]) xrealloc(w->attrs, sizeof(w->attrs[0]) * (w->nattr + 16));
+		memset(w->attrs[w->nattr], 0, 4);
+		if (attr[0])
+		{
+			w->attrs[w->nattr][0] = attr[0];
+			w->attrs[w->nattr][1] = attr[1];
+		}
+		w->amap[code] = ++w->nattr;
+	}
+
+	delta = off - w->last;
+	q = (idf > 0.0 ? (unsigned int) (idf * XTOK_IDF_SCALE + 0.5) : 0);
+	n = _varint_put(buf, ((unsigned int) delta << 1) ^ (unsigned int) (delta >> 31));
+	n += _varint_put(buf + n, (unsigned int) len);
+	n += _varint_put(buf + n, w->amap[code] - 1);
+	n += _varint_put(buf + n, q);
+	if (w->flags & XTOK_F_ID)
+	{
+		/* the hashed id of the stored text is left to the reader (not the id of a converted text) */
+		if (w->text != NULL && (id & XTOK_ID_HASHED) && off >= 0 && len >= 0 && (off + len) <= w->docs[w->ndoc].len
+			&& id == _xtok_hash_id(w->text + off, len))
+			id = 0;
+		n += _varint_put(buf + n, id);
+	}
+	_xtok_write(w, buf, n);
+
+	w->last = off + len;
+	w->docs[w->ndoc].ntok++;
+	w->ntoken++;
+}
+
+void xtok_doc_end(xtok_writer_t w)
+{
+	w->docs[w->ndoc].end = w->pos;
+	w->ndoc++;
+}
+
+int xtok_finish(xtok_writer_t w)
+{
+	struct xtok_header hdr;
+	FILE *fp = (FILE *) w->fp;
+	char pad[8];
+	int ret;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, XTOK_MAGIC, 4);
+	hdr.version = XTOK_VERSION;
+	hdr.flags = w->flags;
+	hdr.idf_scale = XTOK_IDF_SCALE;
+	hdr.ndoc = w->ndoc;
+	hdr.nattr = w->nattr;
+	hdr.ntoken = w->ntoken;
+	hdr.off_attr = w->pos;
+	_xtok_write(w, w->attrs, sizeof(w->attrs[0]) * w->nattr);
+
+	/* the index is aligned for the mapped access */
+	memset(pad, 0, sizeof(pad));
+	_xtok_write(w, pad, (size_t) ((8 - (w->pos & 7)) & 7));
+	hdr.off_index = w->pos;
+	_xtok_write(w, w->docs, sizeof(struct xtok_doc) * w->ndoc);
+	hdr.size = w->pos;
+
+	rewind(fp);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		w->error = 1;
+	ret = (fclose(fp) || w->error) ? -1 : 0;
+
+	xfree(w->docs);
+	xfree(w->attrs);
+	xfree(w->amap);
+	xfree(w);
+	return ret;
+}
+
+xtok_t xtok_open(const char *fpath)
+{
+	struct xtok_header *hdr;
+	struct stat st;
+	xtok_t t;
+	unsigned int i;
+	int fd;
+
+	if ((fd = open(fpath, O_RDONLY | O_BINARY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < (off_t) sizeof(struct xtok_header)
+		|| (off_t) (size_t) st.st_size != st.st_size)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	if ((t = (xtok_t) xmalloc(sizeof(xtok_st))) == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+	memset(t, 0, sizeof(xtok_st));
+	t->size = (unsigned long long) st.st_size;
+#ifdef HAVE_MMAP
+	if ((t->map = (unsigned char *) mmap(NULL, (size_t) t->size, PROT_READ, MAP_SHARED, fd, 0)) == (unsigned char *) MAP_FAILED)
+		t->map = NULL;
+	else
+		t->map_type = 1;
+#endif
+	if (t->map == NULL)
+	{
+		size_t n, len;
+		int r;
+
+		t->map = (unsigned char *) xmalloc((size_t) t->size);
+		t->map_type = 2;
+		for (len = 0; t->map != NULL && len < (size_t) t->size; len += r)
+		{
+			n = (size_t) t->size - len;
+			if ((r = read(fd, t->map + len, n > 0x40000000 ? 0x40000000 : n)) <= 0)
+				break;
+		}
+		if (len != (size_t) t->size)
+			t->size = 0;
+	}
+	close(fd);
+
+	/* check the header & the bounds */
+	hdr = t->hdr = (struct xtok_header *) t->map;
+	if (t->size < sizeof(struct xtok_header) || memcmp(hdr->magic, XTOK_MAGIC, 4) || hdr->version != XTOK_VERSION
+		|| hdr->size != t->size || hdr->idf_scale <= 0 || hdr->nattr < 0 || hdr->nattr > XTOK_MAX_ATTR
+		|| hdr->off_attr < sizeof(struct xtok_header) || hdr->off_attr > hdr->off_index
+		|| 4ULL * hdr->nattr > hdr->off_index - hdr->off_attr
+		|| (hdr->off_index & 7) || hdr->off_index + sizeof(struct xtok_doc) * (unsigned long long) hdr->ndoc != hdr->size)
+	{
+		xtok_close(t);
+		return NULL;
+	}
+	t->attrs = (const char (*)[4]) (t->map + hdr->off_attr);
+	t->docs = (const struct xtok_doc *) (t->map + hdr->off_index);
+	t->ndoc = hdr->ndoc;
+	t->flags = hdr->flags;
+	for (i = 0; i < t->ndoc; i++)
+	{
+		if (t->docs[i].off < sizeof(struct xtok_header) || t->docs[i].len < 0 || t->docs[i].end > hdr->off_attr
+			|| t->docs[i].off > t->docs[i].end || (unsigned long long) t->docs[i].len > t->docs[i].end - t->docs[i].off)
+		{
+			xtok_close(t);
+			return NULL;
+		}
+	}
+	return t;
+}
+
+void xtok_close(xtok_t t)
+{
+	if (t->map != NULL)
+	{
+#ifdef HAVE_MMAP
+		if (t->map_type == 1)
+			munmap(t->map, (size_t) t->size);
+		else
+#endif
+		xfree(t->map);
+	}
+	xfree(t);
+}
+
+int xtok_doc(xtok_t t, unsigned int i, xtok_iter *it)
+{
+	const struct xtok_doc *d;
+
+	if (i >= t->ndoc)
+		return -1;
+	d = &t->docs[i];
+	it->p = t->map + d->off + ((t->flags & XTOK_F_TEXT) ? d->len : 0);
+	it->end = t->map + d->end;
+	it->left = d->ntok;
+	it->last = 0;
+	it->text = t->map + d->off;
+	it->len = (t->flags & XTOK_F_TEXT) ? d->len : 0;
+	return (int) d->ntok;
+}
+
+int xtok_next(xtok_t t, xtok_iter *it, struct xtok_token *tok)
+{
+	unsigned int v, a;
+
+	if (it->left == 0 || it->p >= it->end)
+		return 0;
+
+	it->left--;
+	v = _varint_get(&it->p, it->end);
+	tok->off = (int) ((unsigned int) it->last + ((v >> 1) ^ (0U - (v & 1))));
+	tok->len = (int) _varint_get(&it->p, it->end);
+	a = _varint_get(&it->p, it->end);
+	if (a < (unsigned int) t->hdr->nattr)
+		memcpy(tok->attr, t->attrs[a], 4);
+	else
+		memset(tok->attr, 0, 4);
+	tok->idf = (float) _varint_get(&it->p, it->end) / t->hdr->idf_scale;
+	tok->id = (t->flags & XTOK_F_ID) ? _varint_get(&it->p, it->end) : 0;
+	it->last = (int) ((unsigned int) tok->off + (unsigned int) tok->len);
+	if (tok->id == 0 && (t->flags & XTOK_F_ID) && (t->flags & XTOK_F_TEXT)
+		&& tok->off >= 0 && tok->len >= 0 && tok->off <= it->len && tok->len <= it->len - tok->off)
+		tok->id = _xtok_hash_id(it->text + tok->off, tok->len);
+	return 1;
+}
+
+const char *xtok_text(xtok_t t, unsigned int i, int *len)
+{
+	if (i >= t->ndoc || !(t->flags & XTOK_F_TEXT))
+		return NULL;
+	*len = t->docs[i].len;
+	return (const char *) t->map + t->docs[i].off;
+}
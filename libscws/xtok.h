@@ -0,0 +1,136 @@
+/**
+ * @file xtok.h (binary pre-segmented token stream: writer & mmap reader)
+ * @author Hightman Mar
+ * @editor set number ; syntax on ; set autoindent ; set tabstop=4 (vim)
+ * $Id$
+ */
+
+#ifndef	_SCWS_XTOK_20261018_H_
+#define	_SCWS_XTOK_20261018_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * file layout (native byte order, the offsets are from the file head):
+ *   header | doc 0 [text] [tokens] | doc 1 ... | attr table | (pad to 8) doc index
+ * tokens of a doc, all varint (7 bits a byte, low first, the high bit means more):
+ *   <off delta> <len> <attr id> <idf * idf_scale> [<word id>]
+ *   off delta is zigzag of off - (off + len of the previous token), 0 for adjacent tokens,
+ *   it may be negative for the child words of the multi mode.
+ *   word id 0 with the text stored: a hashed id (bit 31 set), computed again from the text
+ *   (the hashed id not of the stored bytes, e.g. from a converted text, is stored as it is)
+ * attr table: nattr * 4 bytes (the attr, '\0' padded), indexed by the attr id
+ * doc index: ndoc * struct xtok_doc
+ */
+#define	XTOK_MAGIC			"XTOK"
+#define	XTOK_VERSION		1
+#define	XTOK_IDF_SCALE		100
+
+#define	XTOK_F_TEXT			0x01		/* the text of each doc is stored before its tokens */
+#define	XTOK_F_ID			0x02		/* the word ids are stored */
+
+struct xtok_header
+{
+	char magic[4];
+	int version;
+	int flags;
+	int idf_scale;
+	unsigned int ndoc;
+	int nattr;
+	unsigned long long ntoken;
+	unsigned long long off_attr;
+	unsigned long long off_index;
+	unsigned long long size;
+};
+
+struct xtok_doc
+{
+	unsigned long long off;		/* the text (if stored), the tokens follow it */
+	unsigned int ntok;
+	int len;					/* text length, tokens start at off + len if XTOK_F_TEXT */
+	unsigned long long end;		/* end of the tokens */
+};
+
+/* a decoded token */
+struct xtok_token
+{
+	int off;					/* in the doc text */
+	int len;
+	float idf;
+	char attr[4];
+	unsigned int id;			/* 0 if XTOK_F_ID is not set */
+};
+
+/* writer: the docs are appended one by one, the tables are written by xtok_finish */
+typedef struct
+{
+	void *fp;
+	int flags;
+	int nattr;
+	unsigned short *amap;		/* attr code -> id + 1 */
+	char (*attrs)[4];
+	unsigned int ndoc;
+	unsigned int dsize;
+	struct xtok_doc *docs;
+	unsigned long long pos;
+	unsigned long long ntoken;
+	int last;					/* end of the last token in the doc */
+	const unsigned char *text;	/* of the doc, NULL if not stored */
+	int error;
+}	xtok_writer_st, *xtok_writer_t;
+
+/* reader: the whole file is mapped (or read if mmap is not available) */
+typedef struct
+{
+	unsigned char *map;
+	unsigned long long size;
+	int map_type;				/* 1: mmap, 2: malloc */
+	struct xtok_header *hdr;
+	const char (*attrs)[4];
+	const struct xtok_doc *docs;
+	unsigned int ndoc;
+	int flags;
+}	xtok_st, *xtok_t;
+
+/* iterator of the tokens of a doc */
+typedef struct
+{
+	const unsigned char *p;
+	const unsigned char *end;
+	unsigned int left;
+	int last;
+	const unsigned char *text;
+	int len;
+}	xtok_iter;
+
+/* flags: XTOK_F_xxx, return NULL if the file can't be created */
+xtok_writer_t xtok_create(const char *fpath, int flags);
+
+/* a doc: begin (the text is stored if XTOK_F_TEXT, keep it until the end), put the tokens in order, end */
+void xtok_doc_begin(xtok_writer_t w, const char *text, int len);
+void xtok_put(xtok_writer_t w, int off, int len, const char *attr, float idf, unsigned int id);
+void xtok_doc_end(xtok_writer_t w);
+
+/* write the tables & close, free the writer, return 0 on success */
+int xtok_finish(xtok_writer_t w);
+
+/* open & check a stream, return NULL if it is broken */
+xtok_t xtok_open(const char *fpath);
+void xtok_close(xtok_t t);
+
+/* the i-th doc: set up the iterator & return the number of tokens, -1 if out of range */
+int xtok_doc(xtok_t t, unsigned int i, xtok_iter *it);
+
+/* next token of the doc, return 0 at the end */
+int xtok_next(xtok_t t, xtok_iter *it, struct xtok_token *tok);
+
+/* the stored text of the i-th doc (not '\0' terminated), NULL if not stored */
+const char *xtok_text(xtok_t t, unsigned int i, int *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,6 +13,7 @@
 
 #include "xtree.h"
 #include "xdb.h"
+#include "xalloc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,7 +30,7 @@ static int _xtree_key_cmp(node_t head, const char *key, scws_io_size_t len) {
 	*/
 	for (scws_io_size_t i = 0; i < len; i++) {
 		if (head->key[i] == 0) return 1; // 说明len - hlen > 0，返回正数
-		int diff = (int)key[i] - (int)head->key[i];
+		int diff = (int)(unsigned char)key[i] - (int)(unsigned char)head->key[i];
 		if (diff != 0) return diff;
 	}
 	if (head->key[len] == 0) return 0;
@@ -185,7 +186,7 @@ static void _xtree_draw_node(node_t node, struct draw_arg *arg, int depth, char
 {
 	char *icon2;
 	
-	icon2 = malloc(strlen(icon1) + 4);
+	icon2 = xmalloc(strlen(icon1) + 4);
 	strcpy(icon2, icon1);
 
 	// output the flag & icon
@@ -225,7 +226,7 @@ static void _xtree_draw_node(node_t node, struct draw_arg *arg, int depth, char
 		arg->flag = 'R';
 		_xtree_draw_node(node->right, arg, depth, icon2);
 	}
-	free(icon2);
+	xfree(icon2);
 }
 
 void xtree_draw(xtree_t xt)
@@ -282,37 +283,18 @@ static scws_io_size_t _xtree_load_nodes(node_t head, node_t *dst)
 	return cnt;
 }
 
-static node_t _xtree_make_prefect_subtree(const node_t* ordered, unsigned char n_layer) {
-	if (n_layer == 0) return NULL;
-	if (n_layer == 1) return ordered[0];
-	// 1 ~ 2**n-1
-	for (scws_io_size_t i = 1; i >> n_layer == 0; i++) {
-		node_t cur = ordered[i - 1];
-		unsigned int n_tz = _bit_ctzll((unsigned long long)i);
-		if (n_tz) {
-			cur->left  = ordered[i - (1ULL << (n_tz - 1)) - 1];
-			cur->right = ordered[i + (1ULL << (n_tz - 1)) - 1];
-		} else {
-			cur->left  = NULL;
-			cur->right = NULL;
-		}
-	}
-	return ordered[(1ULL << (n_layer - 1)) - 1];
-}
+static node_t _xtree_reorganize_nodes(node_t *ordered, scws_io_size_t count)
+{
+	scws_io_size_t mid;
+	node_t head;
 
-static node_t _xtree_reorganize_nodes(const node_t *ordered, const scws_io_size_t count)
-{	// TsXor: reorganize node with O(1) space and O(n) time
-	unsigned char n_layer = 0;
-	const node_t* sub = ordered + count;
-	node_t head = NULL;
-	for (scws_io_size_t left = count; left != 0; left >>= 1) {
-		node_t last_head = head;
-		head = sub[-1];
-		sub -= 1ULL << n_layer;
-		head->left = _xtree_make_prefect_subtree(sub, n_layer);
-		head->right = last_head;
-		n_layer++;
-	}
+	if (count == 0)
+		return NULL;
+
+	mid = count >> 1;
+	head = ordered[mid];
+	head->left = _xtree_reorganize_nodes(ordered, mid);
+	head->right = _xtree_reorganize_nodes(ordered + mid + 1, count - mid - 1);
 	return head;
 }
 
@@ -332,11 +314,11 @@ void xtree_optimize(xtree_t xt)
 		scws_io_size_t n_tree_nodes = _xtree_count_nodes(tree_head);
 		if (n_tree_nodes <= 2) continue;			
 		
-		node_t *nodes_array = (node_t *)malloc(sizeof(node_t) * n_tree_nodes);
+		node_t *nodes_array = (node_t *)xmalloc(sizeof(node_t) * n_tree_nodes);
 		scws_io_size_t n_loaded = _xtree_load_nodes(tree_head, nodes_array);
 		qsort(nodes_array, n_loaded, sizeof(node_t), _xtree_node_cmp);
-		tree_head = _xtree_reorganize_nodes(nodes_array, n_loaded);
-		free(nodes_array);
+		xt->trees[i] = _xtree_reorganize_nodes(nodes_array, n_loaded);
+		xfree(nodes_array);
 	}
 }
 
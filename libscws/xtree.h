@@ -19,6 +19,7 @@ extern "C" {
 #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
 #include <intrin.h>
 #pragma intrinsic(_BitScanForward)
+#pragma intrinsic(_BitScanReverse)
 #endif
 
 static inline unsigned int _bit_ctzll(unsigned long long v) {
@@ -43,6 +44,25 @@ static inline unsigned int _bit_ctzll(unsigned long long v) {
 #endif
 }
 
+/* v must be non-zero, as with _bit_ctzll */
+static inline unsigned int _bit_clzll(unsigned long long v) {
+#if defined(__GNUC__) || defined(__clang__)
+	return (unsigned int)__builtin_clzll(v);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long result;
+	_BitScanReverse64(&result, v);
+	return 63 - result;
+#else
+	unsigned int n = 0;
+	while (!(v & 0x8000000000000000ULL))
+	{
+		v <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
 /* pool required */
 #include "pool.h"
 
@@ -49,13 +49,19 @@ if test "$PHP_SCWS" != "no"; then
     PHP_SUBST(SCWS_SHARED_LIBADD)
     PHP_NEW_EXTENSION(scws, php_scws.c, $ext_shared)
   else
-    dnl # use bundled library
+    dnl # use bundled library (no HAVE_PTHREAD & HAVE_ICONV: single-threaded, no input conversion)
     PHP_SCWS_CFLAGS="-I@ext_srcdir@ -I@ext_srcdir@/libscws"
     
     libscws_src="libscws/charset.c libscws/darray.c \
 		 libscws/pool.c libscws/rule.c \
 		 libscws/scws.c libscws/xdb.c libscws/lock.c\
-		 libscws/xdict.c libscws/xtree.c"
+		 libscws/xdict.c libscws/xtree.c \
+		 libscws/xthread.c \
+		 libscws/xclass.c \
+		 libscws/xstat.c \
+		 libscws/xalloc.c \
+		 libscws/xtok.c \
+		 libscws/crc32.c"
 		 
     dnl # check -lm (math lib)
     AC_CHECK_LIB(m, expf, [ PHP_ADD_LIBRARY(m,,SCWS_SHARED_LIBADD) ],
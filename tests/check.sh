@@ -0,0 +1,57 @@
+#!/bin/sh
+# $Id$
+#
+# segment the fixed corpus by the small dict in some modes & compare it to the golden output,
+# the compiled ruleset & the token stream written and read back must give the same words.
+# the golden output is made by: check.sh -g
+
+srcdir=${srcdir:-.}
+top_srcdir=${top_srcdir:-$srcdir/..}
+top_builddir=${top_builddir:-..}
+
+SCWS="$top_builddir/cli/scws -c utf8 -N -A -d check.xdb"
+GEN=$top_builddir/cli/scws-gen-dict
+RULES=$top_srcdir/etc/rules.utf8.ini
+CORPUS=$srcdir/corpus.txt
+GOLDEN=$srcdir/corpus.out
+
+fail()
+{
+	echo "FAIL: $*"
+	exit 1
+}
+
+# segment in all the modes by the ruleset $1
+segment()
+{
+	for opt in "" "-I" "-U" "-M 3" "-M 12" "-M 15" "-G 1" "-G 2" "-T 2"
+	do
+		echo "# $opt"
+		$SCWS -r $1 $opt -i $CORPUS || return 1
+	done
+}
+
+rm -f check.xdb check.rdb check.xtok
+$GEN -c utf8 -i $srcdir/dict.txt -o check.xdb >/dev/null || fail "dict"
+$GEN -c utf8 -r -i $RULES -o check.rdb >/dev/null || fail "compile the ruleset"
+
+if test "$1" = "-g"; then
+	segment $RULES > $GOLDEN || fail "segment"
+	exit 0
+fi
+
+segment $RULES > check.out || fail "segment"
+diff -u $GOLDEN check.out || fail "segment, differ from the golden output"
+
+segment check.rdb > check.out || fail "segment by the compiled ruleset"
+diff -u $GOLDEN check.out || fail "the compiled ruleset"
+
+for opt in "" "-M 15"
+do
+	$SCWS -r $RULES $opt -i $CORPUS > check.out || fail "segment"
+	$SCWS -r $RULES $opt -i $CORPUS -O check.xtok || fail "write the token stream"
+	$top_builddir/cli/scws -N -A -i check.xtok > check.tmp || fail "read the token stream"
+	diff -u check.out check.tmp || fail "the token stream ($opt)"
+done
+
+exit 0
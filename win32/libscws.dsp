@@ -124,6 +124,26 @@ SOURCE=..\libscws\xdict.c
 
 SOURCE=..\libscws\xtree.c
 # End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xthread.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xclass.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xstat.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xalloc.c
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xtok.c
+# End Source File
 # End Group
 # Begin Group "Header Files"
 
@@ -172,6 +192,26 @@ SOURCE=..\libscws\xdict.h
 
 SOURCE=..\libscws\xtree.h
 # End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xthread.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xclass.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xstat.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xalloc.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\libscws\xtok.h
+# End Source File
 # End Group
 # End Target
 # End Project